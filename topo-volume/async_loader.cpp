@@ -0,0 +1,180 @@
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <vtkImageData.h>
+#include "imgui-1.49/imgui.h"
+#include "async_loader.h"
+
+static const char* stage_name(const AsyncLoader::Stage s) {
+	switch (s) {
+		case AsyncLoader::LOADING_VOLUME: return "Loading volume";
+		case AsyncLoader::BUILDING_HISTOGRAM: return "Building histogram";
+		case AsyncLoader::HASHING_VOLUME: return "Hashing volume for the topology cache";
+		case AsyncLoader::COMPUTING_PERSISTENCE: return "Computing persistence diagram and curve";
+		case AsyncLoader::COMPUTING_TREE: return "Computing tree and segmentation";
+		case AsyncLoader::DONE: return "Done";
+		case AsyncLoader::CANCELLED: return "Cancelled";
+		case AsyncLoader::FAILED: return "Failed";
+		default: return "Unknown";
+	}
+}
+
+AsyncLoader::AsyncLoader(const std::string &file, LoadFn load_fn, const std::string &cache_dir,
+		unsigned int debuglevel, PipelineProfiler *profiler)
+	: file(file), load_fn(load_fn), cache_dir(cache_dir), debuglevel(debuglevel), profiler(profiler),
+	stage(LOADING_VOLUME), cancel_requested(false), volume_done(false),
+	start_time(std::chrono::steady_clock::now()), stage_start_time(start_time),
+	vol_render_size(1)
+{
+	file_input.fill('\0');
+	std::strncpy(file_input.data(), file.c_str(), file_input.size() - 1);
+	worker = std::thread([this](){ run(); });
+}
+AsyncLoader::~AsyncLoader() {
+	if (!finished()) {
+		std::cout << "Waiting for the loader to finish its current stage..." << std::endl;
+	}
+	cancel();
+	worker.join();
+}
+AsyncLoader::Stage AsyncLoader::get_stage() const {
+	return static_cast<Stage>(stage.load());
+}
+void AsyncLoader::cancel() {
+	cancel_requested = true;
+}
+bool AsyncLoader::finished() const {
+	const Stage s = get_stage();
+	return s == DONE || s == CANCELLED || s == FAILED;
+}
+bool AsyncLoader::volume_ready() const {
+	return volume_done && volume;
+}
+bool AsyncLoader::topology_ready() const {
+	return get_stage() == DONE && tree_widget;
+}
+glm::vec3 AsyncLoader::get_render_size() const {
+	return vol_render_size;
+}
+std::unique_ptr<Volume> AsyncLoader::take_volume() {
+	if (!volume_done) {
+		return nullptr;
+	}
+	return std::move(volume);
+}
+void AsyncLoader::take_topology(std::unique_ptr<TopologyCache> &c,
+		std::unique_ptr<PersistenceCurveWidget> &pcw,
+		vtkSmartPointer<ttkFTMTree> &cf, std::unique_ptr<TreeWidget> &tw)
+{
+	if (get_stage() != DONE) {
+		return;
+	}
+	c = std::move(cache);
+	pcw = std::move(persistence_curve_widget);
+	cf = contour_forest;
+	contour_forest = nullptr;
+	tw = std::move(tree_widget);
+}
+bool AsyncLoader::draw_ui(std::string &new_file) {
+	bool load_new = false;
+	if (ImGui::Begin("Loading")) {
+		using namespace std::chrono;
+		const Stage s = get_stage();
+		ImGui::TextWrapped("%s", file.c_str());
+
+		steady_clock::time_point stage_start;
+		std::string err;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stage_start = stage_start_time;
+			err = error;
+		}
+		const auto now = steady_clock::now();
+		const float total_elapsed = duration_cast<duration<float>>(now - start_time).count();
+		const float stage_elapsed = duration_cast<duration<float>>(now - stage_start).count();
+		if (!finished()) {
+			ImGui::Text("%s (%.1fs)", stage_name(s), stage_elapsed);
+			ImGui::ProgressBar(static_cast<float>(s) / DONE);
+			ImGui::Text("Total %.1fs", total_elapsed);
+			if (cancel_requested) {
+				ImGui::Text("Cancelling, waiting for the current stage to finish...");
+			} else if (ImGui::Button("Cancel")) {
+				cancel();
+			}
+		} else {
+			ImGui::Text("%s", stage_name(s));
+			if (s == FAILED) {
+				ImGui::TextWrapped("Error: %s", err.c_str());
+			}
+			ImGui::InputText("File", file_input.data(), file_input.size());
+			if (ImGui::Button("Load")) {
+				new_file = file_input.data();
+				load_new = !new_file.empty();
+			}
+		}
+	}
+	ImGui::End();
+	return load_new;
+}
+void AsyncLoader::run() {
+	try {
+		vol_data = load_fn(file, &cancel_requested);
+		check_cancelled();
+		for (size_t i = 0; i < 3; ++i) {
+			vol_render_size[i] = vol_data->GetSpacing()[i] * vol_data->GetDimensions()[i];
+		}
+
+		set_stage(BUILDING_HISTOGRAM);
+		volume = std::make_unique<Volume>(vol_data.Get(), nullptr, debuglevel);
+		volume_done = true;
+		check_cancelled();
+
+		if (!cache_dir.empty()) {
+			set_stage(HASHING_VOLUME);
+			cache = std::make_unique<TopologyCache>(cache_dir, vol_data.Get());
+			check_cancelled();
+		}
+
+		set_stage(COMPUTING_PERSISTENCE);
+		persistence_curve_widget = std::make_unique<PersistenceCurveWidget>(vol_data.Get(),
+				debuglevel, cache.get(), profiler);
+		check_cancelled();
+
+		set_stage(COMPUTING_TREE);
+		contour_forest = persistence_curve_widget->get_pipeline().create_tree();
+		tree_widget = std::make_unique<TreeWidget>(contour_forest,
+				persistence_curve_widget->get_simplification(), cache.get());
+		check_cancelled();
+
+		set_stage(DONE);
+	} catch (const std::exception &e) {
+		if (cancel_requested) {
+			set_stage(CANCELLED);
+		} else {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				error = e.what();
+			}
+			std::cerr << "Failed to load " << file << ": " << e.what() << "\n";
+			set_stage(FAILED);
+		}
+	}
+}
+void AsyncLoader::set_stage(const Stage s) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stage_start_time = std::chrono::steady_clock::now();
+	}
+	if (debuglevel >= 1) {
+		using namespace std::chrono;
+		const float elapsed = duration_cast<duration<float>>(steady_clock::now() - start_time).count();
+		std::cout << "[AsyncLoader] " << stage_name(s) << " at " << elapsed << "s\n";
+	}
+	stage = s;
+}
+void AsyncLoader::check_cancelled() const {
+	if (cancel_requested) {
+		throw std::runtime_error("Load cancelled");
+	}
+}
+
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <glm/glm.hpp>
+#include <vtkSmartPointer.h>
+#include <vtkImageData.h>
+#include <ttkFTMTree.h>
+
+#include "persistence_curve_widget.h"
+#include "pipeline_profiler.h"
+#include "topology_cache.h"
+#include "tree_widget.h"
+#include "volume.h"
+
+/* Loads the volume and computes its topology on a worker thread, so the window
+ * and UI can come up right away and the user can cancel a bad load. The results
+ * of each stage are handed over to the render thread as they become ready: first
+ * the Volume, which can be rendered without a segmentation, then the persistence
+ * and tree widgets once the topology is computed. The worker only touches the
+ * objects it creates until they're taken by the render thread.
+ */
+class AsyncLoader {
+public:
+	enum Stage {
+		LOADING_VOLUME,
+		BUILDING_HISTOGRAM,
+		HASHING_VOLUME,
+		COMPUTING_PERSISTENCE,
+		COMPUTING_TREE,
+		DONE,
+		CANCELLED,
+		FAILED
+	};
+	// Load the volume from a file, checking the cancel flag while reading if possible
+	using LoadFn = std::function<vtkSmartPointer<vtkImageData> (const std::string&,
+			const std::atomic<bool>*)>;
+
+private:
+	std::string file;
+	LoadFn load_fn;
+	std::string cache_dir;
+	unsigned int debuglevel;
+	PipelineProfiler *profiler;
+
+	std::atomic<int> stage;
+	std::atomic<bool> cancel_requested;
+	// Set once the volume stage is done and the volume is ready to take
+	std::atomic<bool> volume_done;
+	std::chrono::steady_clock::time_point start_time, stage_start_time;
+	// Protects the error message and stage start time
+	mutable std::mutex mutex;
+	std::string error;
+
+	vtkSmartPointer<vtkImageData> vol_data;
+	glm::vec3 vol_render_size;
+	std::unique_ptr<Volume> volume;
+	std::unique_ptr<TopologyCache> cache;
+	std::unique_ptr<PersistenceCurveWidget> persistence_curve_widget;
+	vtkSmartPointer<ttkFTMTree> contour_forest;
+	std::unique_ptr<TreeWidget> tree_widget;
+	std::thread worker;
+
+	// Buffer for the file name input shown when the load fails or is cancelled
+	std::array<char, 512> file_input;
+
+public:
+	/* Start loading the file on a worker thread. If cache_dir is not empty the
+	 * topology is loaded from/stored in a TopologyCache in that directory. The
+	 * profiler, if passed, records the topology pipeline's stages
+	 */
+	AsyncLoader(const std::string &file, LoadFn load_fn, const std::string &cache_dir,
+			unsigned int debuglevel, PipelineProfiler *profiler = nullptr);
+	// Cancels the load if it's still running and waits for the worker to exit
+	~AsyncLoader();
+	AsyncLoader(const AsyncLoader&) = delete;
+	AsyncLoader& operator=(const AsyncLoader&) = delete;
+	Stage get_stage() const;
+	/* Request the load to be cancelled. The worker stops at the next chance it gets,
+	 * which for TTK's filters is when the running one finishes
+	 */
+	void cancel();
+	// Check if the worker has exited, either being done, cancelled or failing
+	bool finished() const;
+	// Check if the volume is loaded and can be taken
+	bool volume_ready() const;
+	// Check if the topology is computed and can be taken
+	bool topology_ready() const;
+	// Get the world space size of the loaded volume, valid once the volume is ready
+	glm::vec3 get_render_size() const;
+	std::unique_ptr<Volume> take_volume();
+	void take_topology(std::unique_ptr<TopologyCache> &cache,
+			std::unique_ptr<PersistenceCurveWidget> &persistence_curve_widget,
+			vtkSmartPointer<ttkFTMTree> &contour_forest, std::unique_ptr<TreeWidget> &tree_widget);
+	/* Draw the loading progress panel. Returns true if the user asked to load a
+	 * different file after this load failed or was cancelled, and sets new_file
+	 */
+	bool draw_ui(std::string &new_file);
+
+private:
+	void run();
+	void set_stage(const Stage s);
+	// Throws if the user has requested we cancel
+	void check_cancelled() const;
+};
+
@@ -0,0 +1,280 @@
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <vtkSmartPointer.h>
+#include <vtkImageData.h>
+#include <vtkDataArray.h>
+#include <vtkPointData.h>
+#include <vtkUnstructuredGrid.h>
+#include <ttkFTMTree.h>
+
+#include "parallel.h"
+#include "process_stats.h"
+#include "volume_io.h"
+#include "topology_cache.h"
+#include "topology_pipeline.h"
+#include "pipeline_profiler.h"
+#include "palette_table.h"
+#include "cpu_renderer.h"
+
+/* Runs the topology pipeline of the viewer without a window or GL context: loads
+ * the volume, computes the persistence diagram and curve, simplifies the data
+ * at the threshold and computes the tree and segmentation, then writes them out.
+ * The time and peak memory use of each stage are printed as JSON.
+ */
+struct BatchOptions {
+	std::string file;
+	std::string out_dir;
+	std::string json_file;
+	std::string cache_dir;
+	std::string render_file;
+	std::string trace_file;
+	VolumeLoadOptions load_options;
+	size_t threads;
+	float threshold;
+	ttk::ftm::TreeType tree_type;
+	int render_width, render_height;
+
+	BatchOptions();
+};
+BatchOptions::BatchOptions() : out_dir("."), threads(0), threshold(4.f),
+	tree_type(ttk::ftm::TreeType::Contour), render_width(1280), render_height(720)
+{}
+
+// The time and peak memory use after a stage of the pipeline
+struct StageStats {
+	std::string name;
+	double seconds;
+	double peak_rss_mb;
+};
+
+static const char *USAGE =
+	"Usage: ./topo-vol-batch <volume file> [options]\n"
+	"Options:\n"
+	"  -out <dir>            Directory to write the outputs to (default .)\n"
+	"  -threads <N>          Number of threads to use (default all cores)\n"
+	"  -threshold <T>        Persistence threshold to simplify the data at (default 4)\n"
+	"  -tree <type>          Tree type: contour, split or join (default contour)\n"
+	"  -cache <dir>          Load/store the topology in a cache directory\n"
+	"  -json <file>          Write the stats to a file instead of stdout\n"
+	"  -trace <file>         Write the time of each filter as a Chrome trace\n"
+	"  -render <file.ppm>    Render the segmented volume on the CPU with the default palette\n"
+	"  -render-size <W> <H>  Size of the rendered image (default 1280 720)\n"
+	"  -debug <level>        TTK debug level\n"
+	"  -raw-big-endian, -raw-loader <mmap|parallel|vtk>, -raw-chunk-size <MB>\n"
+	"                        RAW file options, as for topo-vol\n";
+
+static BatchOptions parse_options(int argc, const char **argv) {
+	BatchOptions opts;
+	opts.file = argv[1];
+	for (int i = 2; i < argc; ++i) {
+		const std::string str(argv[i]);
+		// All our options except the flags take a value
+		if (str != "-raw-big-endian" && i + 1 >= argc) {
+			throw std::runtime_error("Missing value for option " + str);
+		}
+		if (str == "-out") {
+			opts.out_dir = argv[++i];
+		} else if (str == "-threads") {
+			opts.threads = std::stoull(argv[++i]);
+		} else if (str == "-threshold") {
+			opts.threshold = std::stof(argv[++i]);
+		} else if (str == "-tree") {
+			opts.tree_type = parse_tree_type(argv[++i]);
+		} else if (str == "-cache") {
+			opts.cache_dir = argv[++i];
+		} else if (str == "-json") {
+			opts.json_file = argv[++i];
+		} else if (str == "-trace") {
+			opts.trace_file = argv[++i];
+		} else if (str == "-render") {
+			opts.render_file = argv[++i];
+		} else if (str == "-render-size") {
+			if (i + 2 >= argc) {
+				throw std::runtime_error("-render-size takes a width and height");
+			}
+			opts.render_width = std::stoi(argv[++i]);
+			opts.render_height = std::stoi(argv[++i]);
+		} else if (str == "-debug") {
+			opts.load_options.debuglevel = std::stoi(argv[++i]);
+		} else if (!parse_raw_option(argc, argv, i, opts.load_options)) {
+			throw std::runtime_error("Unrecognized option '" + str + "'");
+		}
+	}
+	return opts;
+}
+static std::string json_escape(const std::string &str) {
+	std::string out;
+	for (const char c : str) {
+		switch (c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20) {
+					char buf[8];
+					std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+					out += buf;
+				} else {
+					out += c;
+				}
+		}
+	}
+	return out;
+}
+static const char* tree_type_name(const ttk::ftm::TreeType &tree_type) {
+	switch (tree_type) {
+		case ttk::ftm::TreeType::Split: return "split";
+		case ttk::ftm::TreeType::Join: return "join";
+		default: return "contour";
+	}
+}
+// Get the name of the volume file without its directory or extension, to name the outputs
+static std::string base_name(const std::string &file) {
+	const size_t slash = file.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? file : file.substr(slash + 1);
+	const size_t dot = name.find_last_of('.');
+	return dot == std::string::npos ? name : name.substr(0, dot);
+}
+/* Render the segmented volume with the default palette on every segment from the
+ * viewer's starting view, looking down the z axis at the volume
+ */
+static void render_volume(vtkImageData *vol_data, vtkImageData *segmentation, const BatchOptions &opts) {
+	std::array<int, 3> dims;
+	glm::vec3 render_size;
+	for (size_t i = 0; i < 3; ++i) {
+		dims[i] = vol_data->GetDimensions()[i];
+		render_size[i] = vol_data->GetSpacing()[i] * dims[i];
+	}
+	vtkDataArray *seg_data = segmentation->GetPointData()->GetArray("SegmentationId");
+	CpuRenderer renderer(vol_data->GetPointData()->GetScalars(), seg_data, dims);
+
+	const PaletteTable palettes = PaletteTable::ramp(256);
+	const size_t num_segments = seg_data ? static_cast<size_t>(seg_data->GetRange()[1]) + 1 : 1;
+	renderer.set_classification(palettes, std::vector<unsigned int>(num_segments, 1),
+			std::vector<unsigned int>(num_segments, 0));
+
+	RenderView view = initial_view(render_size, opts.render_width, opts.render_height);
+	view.frames = 16;
+	write_ppm(opts.render_file, renderer.render(view));
+}
+static void write_stats(std::ostream &out, const BatchOptions &opts, vtkImageData *vol_data,
+		const size_t num_segments, const std::vector<StageStats> &stages, const double total_seconds)
+{
+	const int *dims = vol_data->GetDimensions();
+	out << "{\n"
+		<< "  \"file\": \"" << json_escape(opts.file) << "\",\n"
+		<< "  \"dims\": [" << dims[0] << ", " << dims[1] << ", " << dims[2] << "],\n"
+		<< "  \"threads\": " << get_num_threads() << ",\n"
+		<< "  \"threshold\": " << opts.threshold << ",\n"
+		<< "  \"tree_type\": \"" << tree_type_name(opts.tree_type) << "\",\n"
+		<< "  \"num_segments\": " << num_segments << ",\n"
+		<< "  \"stages\": [\n";
+	for (size_t i = 0; i < stages.size(); ++i) {
+		out << "    {\"name\": \"" << stages[i].name << "\", \"seconds\": " << stages[i].seconds
+			<< ", \"peak_rss_mb\": " << stages[i].peak_rss_mb << "}" << (i + 1 < stages.size() ? "," : "") << "\n";
+	}
+	out << "  ],\n"
+		<< "  \"total_seconds\": " << total_seconds << ",\n"
+		<< "  \"peak_rss_mb\": " << peak_rss_mb() << "\n"
+		<< "}\n";
+}
+static void run_batch(const BatchOptions &opts) {
+	using namespace std::chrono;
+	set_num_threads(opts.threads);
+	std::vector<StageStats> stages;
+	const auto start = steady_clock::now();
+	auto stage_start = start;
+	auto end_stage = [&](const std::string &name) {
+		const auto now = steady_clock::now();
+		stages.push_back(StageStats{name, duration_cast<duration<double>>(now - stage_start).count(), peak_rss_mb()});
+		stage_start = now;
+	};
+
+	// When the stats go to stdout send anything else printed there, e.g. TTK's debug
+	// output, to stderr so stdout is just the JSON
+	std::streambuf *stdout_buf = std::cout.rdbuf();
+	if (opts.json_file.empty()) {
+		std::cout.rdbuf(std::cerr.rdbuf());
+	}
+
+	vtkSmartPointer<vtkImageData> vol_data = load_volume(opts.file, opts.load_options);
+	end_stage("load_volume");
+
+	std::unique_ptr<TopologyCache> cache;
+	if (!opts.cache_dir.empty()) {
+		cache = std::make_unique<TopologyCache>(opts.cache_dir, vol_data.Get());
+		end_stage("hash_volume");
+	}
+
+	vtkSmartPointer<PipelineProfiler> profiler = vtkSmartPointer<PipelineProfiler>::New();
+	TopologyPipeline pipeline(vol_data.Get(), opts.load_options.debuglevel, cache.get(),
+			static_cast<int>(get_num_threads()), profiler.Get());
+	pipeline.compute_diagram();
+	end_stage("persistence_diagram");
+	pipeline.compute_curves();
+	end_stage("persistence_curve");
+	pipeline.simplify(opts.threshold, std::numeric_limits<float>::max(), opts.tree_type);
+	end_stage("simplification");
+
+	vtkSmartPointer<ttkFTMTree> contour_forest = pipeline.create_tree();
+	update_tree(contour_forest.Get(), opts.tree_type, cache.get());
+	end_stage("tree");
+
+	vtkUnstructuredGrid *nodes = vtkUnstructuredGrid::SafeDownCast(contour_forest->GetOutput(0));
+	vtkUnstructuredGrid *arcs = vtkUnstructuredGrid::SafeDownCast(contour_forest->GetOutput(1));
+	vtkImageData *segmentation = vtkImageData::SafeDownCast(contour_forest->GetOutput(2));
+	const std::string prefix = opts.out_dir + "/" + base_name(opts.file) + "_" + tree_type_name(opts.tree_type);
+	write_unstructured_grid(prefix + "_nodes.vtu", nodes);
+	write_unstructured_grid(prefix + "_arcs.vtu", arcs);
+	write_image_data(prefix + "_segmentation.vti", segmentation);
+	write_unstructured_grid(opts.out_dir + "/" + base_name(opts.file) + "_diagram.vtu", pipeline.get_diagram());
+	write_table(prefix + "_curve.csv", pipeline.get_curve(opts.tree_type));
+	end_stage("write_outputs");
+
+	if (!opts.render_file.empty()) {
+		render_volume(vol_data.Get(), segmentation, opts);
+		end_stage("cpu_render");
+	}
+
+	if (!opts.trace_file.empty()) {
+		profiler->write_chrome_trace(opts.trace_file);
+	}
+
+	vtkDataArray *seg_ids = segmentation->GetPointData()->GetArray("SegmentationId");
+	const size_t num_segments = seg_ids ? static_cast<size_t>(seg_ids->GetRange()[1]) + 1 : 0;
+	const double total_seconds = duration_cast<duration<double>>(steady_clock::now() - start).count();
+	if (opts.json_file.empty()) {
+		std::cout.rdbuf(stdout_buf);
+		write_stats(std::cout, opts, vol_data.Get(), num_segments, stages, total_seconds);
+	} else {
+		std::ofstream fout(opts.json_file.c_str());
+		if (!fout) {
+			throw std::runtime_error("Failed to open " + opts.json_file + " to write the stats");
+		}
+		write_stats(fout, opts, vol_data.Get(), num_segments, stages, total_seconds);
+	}
+}
+
+int main(int argc, const char **argv) {
+	if (argc < 2 || std::string(argv[1]) == "-h") {
+		std::cerr << USAGE;
+		return 1;
+	}
+	try {
+		run_batch(parse_options(argc, argv));
+	} catch (const std::exception &e) {
+		std::cerr << "topo-vol-batch failed: " << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <vtkSmartPointer.h>
+#include <vtkImageData.h>
+#include <vtkDataArray.h>
+#include <vtkPointData.h>
+#include <ttkFTMTree.h>
+
+#include "parallel.h"
+#include "volume_io.h"
+#include "topology_pipeline.h"
+#include "histogram.h"
+#include "segment_stats.h"
+#include "occupancy_grid.h"
+#include "palette_coverage.h"
+#include "palette_table.h"
+#include "cpu_renderer.h"
+
+/* Benchmarks the kernels of the core library on a volume: the topology pipeline
+ * stages are run once, since they're slow and TTK caches their outputs, then the
+ * per segment kernels run on the segmentation are repeated and timed.
+ */
+struct BenchOptions {
+	std::string file;
+	VolumeLoadOptions load_options;
+	size_t threads;
+	size_t iterations;
+	float threshold;
+	ttk::ftm::TreeType tree_type;
+	int render_width, render_height;
+
+	BenchOptions();
+};
+BenchOptions::BenchOptions() : threads(0), iterations(5), threshold(4.f),
+	tree_type(ttk::ftm::TreeType::Contour), render_width(640), render_height(480)
+{}
+
+static const char *USAGE =
+	"Usage: ./topo-vol-bench <volume file> [options]\n"
+	"Options:\n"
+	"  -threads <N>          Number of threads to use (default all cores)\n"
+	"  -iterations <N>       Number of times to run each kernel (default 5)\n"
+	"  -threshold <T>        Persistence threshold to simplify the data at (default 4)\n"
+	"  -tree <type>          Tree type: contour, split or join (default contour)\n"
+	"  -render-size <W> <H>  Size of the CPU rendered image (default 640 480)\n"
+	"  -raw-big-endian, -raw-loader <mmap|parallel|vtk>, -raw-chunk-size <MB>\n"
+	"                        RAW file options, as for topo-vol\n";
+
+static BenchOptions parse_options(int argc, const char **argv) {
+	BenchOptions opts;
+	opts.file = argv[1];
+	for (int i = 2; i < argc; ++i) {
+		const std::string str(argv[i]);
+		if (str != "-raw-big-endian" && i + 1 >= argc) {
+			throw std::runtime_error("Missing value for option " + str);
+		}
+		if (str == "-threads") {
+			opts.threads = std::stoull(argv[++i]);
+		} else if (str == "-iterations") {
+			opts.iterations = std::max(std::stoull(argv[++i]), 1ull);
+		} else if (str == "-threshold") {
+			opts.threshold = std::stof(argv[++i]);
+		} else if (str == "-tree") {
+			opts.tree_type = parse_tree_type(argv[++i]);
+		} else if (str == "-render-size") {
+			if (i + 2 >= argc) {
+				throw std::runtime_error("-render-size takes a width and height");
+			}
+			opts.render_width = std::stoi(argv[++i]);
+			opts.render_height = std::stoi(argv[++i]);
+		} else if (!parse_raw_option(argc, argv, i, opts.load_options)) {
+			throw std::runtime_error("Unrecognized option '" + str + "'");
+		}
+	}
+	return opts;
+}
+static double seconds_since(const std::chrono::steady_clock::time_point &start) {
+	using namespace std::chrono;
+	return duration_cast<duration<double>>(steady_clock::now() - start).count();
+}
+static void print_header() {
+	std::cout << std::left << std::setw(24) << "kernel" << std::right
+		<< std::setw(12) << "min ms" << std::setw(12) << "median ms" << std::setw(12) << "max ms"
+		<< std::setw(12) << "throughput" << "\n";
+}
+/* Run the kernel the number of iterations and print the min, median and max time,
+ * along with the throughput of the median time over the items processed, in millions
+ * of the unit per second, e.g. vox for voxels or px for pixels
+ */
+static void bench(const std::string &name, const size_t iterations, const size_t items,
+		const std::string &unit, const std::function<void()> &kernel)
+{
+	std::vector<double> times;
+	for (size_t i = 0; i < iterations; ++i) {
+		const auto start = std::chrono::steady_clock::now();
+		kernel();
+		times.push_back(seconds_since(start));
+	}
+	std::sort(times.begin(), times.end());
+	const double median = times[times.size() / 2];
+	std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(3)
+		<< std::setw(12) << times.front() * 1000.0 << std::setw(12) << median * 1000.0
+		<< std::setw(12) << times.back() * 1000.0
+		<< std::setw(12) << (median > 0.0 ? items / median / 1e6 : 0.0) << " M" << unit << "/s\n";
+}
+static void run_bench(const BenchOptions &opts) {
+	set_num_threads(opts.threads);
+	std::cout << "Benchmarking " << opts.file << " with " << get_num_threads() << " threads\n";
+	print_header();
+
+	vtkSmartPointer<vtkImageData> vol_data;
+	std::array<int, 3> dims;
+	glm::vec3 render_size;
+	size_t voxels = 0;
+	bench("load_volume", 1, 0, "vox", [&]() {
+		vol_data = load_volume(opts.file, opts.load_options);
+		for (size_t i = 0; i < 3; ++i) {
+			dims[i] = vol_data->GetDimensions()[i];
+			render_size[i] = vol_data->GetSpacing()[i] * dims[i];
+		}
+		voxels = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+	});
+	vtkDataArray *data = vol_data->GetPointData()->GetScalars();
+
+	TopologyPipeline pipeline(vol_data.Get(), opts.load_options.debuglevel, nullptr,
+			static_cast<int>(get_num_threads()));
+	bench("persistence_diagram", 1, voxels, "vox", [&]() { pipeline.compute_diagram(); });
+	bench("persistence_curve", 1, voxels, "vox", [&]() { pipeline.compute_curves(); });
+	bench("simplification", 1, voxels, "vox", [&]() {
+		pipeline.simplify(opts.threshold, std::numeric_limits<float>::max(), opts.tree_type);
+	});
+	vtkSmartPointer<ttkFTMTree> contour_forest = pipeline.create_tree();
+	bench("tree", 1, voxels, "vox", [&]() { update_tree(contour_forest.Get(), opts.tree_type, nullptr); });
+
+	vtkImageData *segmentation = vtkImageData::SafeDownCast(contour_forest->GetOutput(2));
+	vtkDataArray *seg_data = segmentation->GetPointData()->GetArray("SegmentationId");
+	const double *range = data->GetRange();
+
+	SegmentHistograms histograms;
+	bench("segment_histograms", opts.iterations, voxels, "vox", [&]() {
+		build_segment_histograms(data, seg_data, range[0], range[1], 128, histograms);
+	});
+	SegmentStats stats;
+	bench("segment_stats", opts.iterations, voxels, "vox", [&]() { build_segment_stats(data, seg_data, dims, stats); });
+	OccupancyGrid grid;
+	bench("occupancy_grid", opts.iterations, voxels, "vox", [&]() { build_occupancy_grid(data, seg_data, dims, grid); });
+
+	const PaletteTable palettes = PaletteTable::ramp(256);
+	const std::vector<unsigned int> selections(stats.size(), 1);
+	const std::vector<unsigned int> segment_palettes(stats.size(), 0);
+	const PaletteCoverage coverage(palettes.alpha(), palettes.samples, 1.f / (range[1] - range[0]), -range[0]);
+	bench("update_occupied", opts.iterations, grid.num_cells(), "cell", [&]() {
+		// Reset the cells to occupied so each run starts from the same state, the update
+		// recomputes every cell
+		std::fill(grid.occupied.begin(), grid.occupied.end(), 1);
+		grid.update_occupied(selections, segment_palettes, coverage);
+	});
+
+	CpuRenderer renderer(data, seg_data, dims);
+	renderer.set_classification(palettes, selections, segment_palettes);
+	const RenderView view = initial_view(render_size, opts.render_width, opts.render_height);
+	bench("cpu_render", opts.iterations, static_cast<size_t>(view.width) * view.height, "px",
+			[&]() { renderer.render(view); });
+}
+
+int main(int argc, const char **argv) {
+	if (argc < 2 || std::string(argv[1]) == "-h") {
+		std::cerr << USAGE;
+		return 1;
+	}
+	try {
+		run_bench(parse_options(argc, argv));
+	} catch (const std::exception &e) {
+		std::cerr << "topo-vol-bench failed: " << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vtkType.h>
+#include "parallel.h"
+#include "brick_cache.h"
+
+// Number of bricks to extract in parallel before uploading them
+static const size_t UPLOAD_BATCH_SIZE = 64;
+
+template<typename Out, typename In>
+static void convert_ids(const In *in, const size_t n, Out *out) {
+	for (size_t i = 0; i < n; ++i) {
+		out[i] = static_cast<Out>(std::max(in[i], In(0)));
+	}
+}
+template<typename In>
+static void convert_ids(const In *in, const size_t n, const GLenum out_type, uint8_t *out) {
+	switch (out_type) {
+		case GL_UNSIGNED_BYTE:
+			convert_ids(in, n, out);
+			break;
+		case GL_UNSIGNED_SHORT:
+			convert_ids(in, n, reinterpret_cast<uint16_t*>(out));
+			break;
+		default:
+			convert_ids(in, n, reinterpret_cast<uint32_t*>(out));
+			break;
+	}
+}
+// Copy the voxels of the brick with its apron from the array, clamping to the edge of the volume
+static void copy_brick(vtkDataArray *array, const std::array<int, 3> &dims, const std::array<int, 3> &origin,
+		uint8_t *out)
+{
+	const size_t elem_size = array->GetDataTypeSize();
+	const uint8_t *src = static_cast<const uint8_t*>(array->GetVoidPointer(0));
+	// The range of x in the slot that's inside the volume and can be copied directly
+	const int x_begin = std::max(-origin[0], 0);
+	const int x_end = std::min(dims[0] - origin[0], BrickCache::SLOT_SIZE);
+	for (int z = 0; z < BrickCache::SLOT_SIZE; ++z) {
+		const size_t sz = std::min(std::max(origin[2] + z, 0), dims[2] - 1);
+		for (int y = 0; y < BrickCache::SLOT_SIZE; ++y) {
+			const size_t sy = std::min(std::max(origin[1] + y, 0), dims[1] - 1);
+			const uint8_t *src_row = src + (sz * dims[1] + sy) * dims[0] * elem_size;
+			uint8_t *out_row = out + (static_cast<size_t>(z) * BrickCache::SLOT_SIZE + y)
+				* BrickCache::SLOT_SIZE * elem_size;
+			for (int x = 0; x < x_begin; ++x) {
+				std::memcpy(out_row + x * elem_size, src_row, elem_size);
+			}
+			if (x_end > x_begin) {
+				std::memcpy(out_row + x_begin * elem_size, src_row + (origin[0] + x_begin) * elem_size,
+						(x_end - x_begin) * elem_size);
+			}
+			for (int x = std::max(x_end, x_begin); x < BrickCache::SLOT_SIZE; ++x) {
+				std::memcpy(out_row + x * elem_size, src_row + (dims[0] - 1) * elem_size, elem_size);
+			}
+		}
+	}
+}
+
+BrickCache::BrickCache(vtkDataArray *data, vtkDataArray *segmentation, const std::array<int, 3> &dims,
+		const TextureFormat &data_format, const TextureFormat &seg_format,
+		const size_t memory_budget, const int max_texture_size, const unsigned int debuglevel)
+	: data(data), segmentation(segmentation), dims(dims), data_format(data_format), seg_format(seg_format),
+	data_atlas(0), seg_atlas(0), page_table(0), update_count(0), debuglevel(debuglevel)
+{
+	for (size_t i = 0; i < 3; ++i) {
+		brick_dims[i] = (dims[i] + BRICK_SIZE - 1) / BRICK_SIZE;
+	}
+	const size_t slot_voxels = static_cast<size_t>(SLOT_SIZE) * SLOT_SIZE * SLOT_SIZE;
+	const size_t slot_bytes = slot_voxels * (data_format.bytes_per_voxel
+			+ (segmentation ? seg_format.bytes_per_voxel : 0));
+	const size_t max_slots = std::min(num_bricks(), std::max(memory_budget / slot_bytes, size_t{1}));
+
+	// Lay out the slots to fill the atlas along x, then y, then z
+	const size_t max_axis_slots = std::max(max_texture_size / SLOT_SIZE, 1);
+	atlas_slots[0] = std::min(max_slots, max_axis_slots);
+	atlas_slots[1] = std::max(std::min(max_slots / atlas_slots[0], max_axis_slots), size_t{1});
+	atlas_slots[2] = std::max(std::min(max_slots / (atlas_slots[0] * atlas_slots[1]), max_axis_slots),
+			size_t{1});
+
+	pages.resize(num_bricks(), 0);
+	slot_brick.resize(num_slots(), -1);
+	slot_last_used.resize(num_slots(), 0);
+	if (debuglevel >= 1) {
+		std::cout << "Bricking volume into " << num_bricks() << " bricks, atlas holds " << num_slots()
+			<< " bricks (" << num_slots() * slot_bytes / (1024 * 1024) << "MB)\n";
+	}
+}
+void BrickCache::allocate(GLuint data_tex, GLuint seg_tex, GLuint page_tex) {
+	data_atlas = data_tex;
+	seg_atlas = seg_tex;
+	page_table = page_tex;
+	const std::array<int, 3> atlas_dims = get_atlas_dims();
+
+	glBindTexture(GL_TEXTURE_3D, data_atlas);
+	glTexImage3D(GL_TEXTURE_3D, 0, data_format.internal_format, atlas_dims[0], atlas_dims[1], atlas_dims[2], 0,
+			data_format.pixel_format, data_format.type, nullptr);
+	// Integer textures can't be linearly filtered
+	const GLenum data_filter = data_format.pixel_format == GL_RED_INTEGER ? GL_NEAREST : GL_LINEAR;
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, data_filter);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, data_filter);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+	if (segmentation) {
+		glBindTexture(GL_TEXTURE_3D, seg_atlas);
+		glTexImage3D(GL_TEXTURE_3D, 0, seg_format.internal_format, atlas_dims[0], atlas_dims[1], atlas_dims[2],
+				0, seg_format.pixel_format, seg_format.type, nullptr);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+
+	glBindTexture(GL_TEXTURE_3D, page_table);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_R32UI, brick_dims[0], brick_dims[1], brick_dims[2], 0,
+			GL_RED_INTEGER, GL_UNSIGNED_INT, pages.data());
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+void BrickCache::update(const OccupancyGrid &occupancy) {
+	++update_count;
+	// Find the bricks overlapping occupied cells, if we don't know the occupancy request all of them
+	const int cells_per_brick = BRICK_SIZE / OccupancyGrid::CELL_SIZE;
+	std::vector<uint8_t> requested(num_bricks(), occupancy.occupied.empty() ? 1 : 0);
+	if (!occupancy.occupied.empty()) {
+		const std::array<int, 3> &grid_dims = occupancy.grid_dims;
+		parallel_for(0, num_bricks(), 256, [&](const size_t begin, const size_t end, const size_t) {
+			for (size_t b = begin; b < end; ++b) {
+				const std::array<int, 3> brick = {
+					static_cast<int>(b % brick_dims[0]),
+					static_cast<int>((b / brick_dims[0]) % brick_dims[1]),
+					static_cast<int>(b / (brick_dims[0] * brick_dims[1]))
+				};
+				for (int z = brick[2] * cells_per_brick;
+						z < std::min((brick[2] + 1) * cells_per_brick, grid_dims[2]) && !requested[b]; ++z)
+				{
+					for (int y = brick[1] * cells_per_brick;
+							y < std::min((brick[1] + 1) * cells_per_brick, grid_dims[1]) && !requested[b]; ++y)
+					{
+						for (int x = brick[0] * cells_per_brick;
+								x < std::min((brick[0] + 1) * cells_per_brick, grid_dims[0]); ++x)
+						{
+							if (occupancy.occupied[(static_cast<size_t>(z) * grid_dims[1] + y) * grid_dims[0] + x]) {
+								requested[b] = 1;
+								break;
+							}
+						}
+					}
+				}
+			}
+		});
+	}
+
+	// Mark the requested resident bricks as used and find the ones we need to load
+	std::vector<size_t> missing;
+	for (size_t b = 0; b < num_bricks(); ++b) {
+		if (!requested[b]) {
+			continue;
+		}
+		if (pages[b] != 0) {
+			slot_last_used[pages[b] - 1] = update_count;
+		} else {
+			missing.push_back(b);
+		}
+	}
+	if (missing.empty()) {
+		return;
+	}
+
+	// Free slots are used first, then slots of bricks that aren't requested, least recently used first
+	std::vector<size_t> available;
+	for (size_t s = 0; s < num_slots(); ++s) {
+		if (slot_brick[s] == -1 || slot_last_used[s] != update_count) {
+			available.push_back(s);
+		}
+	}
+	std::sort(available.begin(), available.end(), [&](const size_t a, const size_t b) {
+		const bool a_free = slot_brick[a] == -1;
+		const bool b_free = slot_brick[b] == -1;
+		if (a_free != b_free) {
+			return a_free;
+		}
+		return slot_last_used[a] < slot_last_used[b];
+	});
+	if (missing.size() > available.size()) {
+		std::cerr << "[BrickCache] " << missing.size() - available.size()
+			<< " visible bricks don't fit in the GPU memory budget and won't be shown\n";
+		missing.resize(available.size());
+	}
+
+	std::vector<size_t> load_slots(missing.size());
+	for (size_t i = 0; i < missing.size(); ++i) {
+		const size_t s = available[i];
+		if (slot_brick[s] != -1) {
+			pages[slot_brick[s]] = 0;
+		}
+		slot_brick[s] = missing[i];
+		slot_last_used[s] = update_count;
+		pages[missing[i]] = s + 1;
+		load_slots[i] = s;
+	}
+
+	upload_bricks(missing, load_slots, true, segmentation != nullptr);
+
+	glBindTexture(GL_TEXTURE_3D, page_table);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, brick_dims[0], brick_dims[1], brick_dims[2],
+			GL_RED_INTEGER, GL_UNSIGNED_INT, pages.data());
+}
+bool BrickCache::can_replace_segmentation(vtkDataArray *seg, const TextureFormat &format) const {
+	return seg && segmentation && format.internal_format == seg_format.internal_format;
+}
+void BrickCache::replace_segmentation(vtkDataArray *seg) {
+	segmentation = seg;
+	std::vector<size_t> bricks, slots;
+	for (size_t s = 0; s < num_slots(); ++s) {
+		if (slot_brick[s] != -1) {
+			bricks.push_back(slot_brick[s]);
+			slots.push_back(s);
+		}
+	}
+	upload_bricks(bricks, slots, false, true);
+}
+const std::array<int, 3>& BrickCache::get_atlas_slots() const {
+	return atlas_slots;
+}
+std::array<int, 3> BrickCache::get_atlas_dims() const {
+	return {atlas_slots[0] * SLOT_SIZE, atlas_slots[1] * SLOT_SIZE, atlas_slots[2] * SLOT_SIZE};
+}
+size_t BrickCache::num_resident() const {
+	return std::count_if(slot_brick.begin(), slot_brick.end(), [](const int64_t b) { return b != -1; });
+}
+size_t BrickCache::num_bricks() const {
+	return static_cast<size_t>(brick_dims[0]) * brick_dims[1] * brick_dims[2];
+}
+size_t BrickCache::num_slots() const {
+	return static_cast<size_t>(atlas_slots[0]) * atlas_slots[1] * atlas_slots[2];
+}
+void BrickCache::extract_brick(const size_t brick, uint8_t *data_out, uint8_t *seg_out) const {
+	const std::array<int, 3> origin = {
+		static_cast<int>(brick % brick_dims[0]) * BRICK_SIZE - APRON,
+		static_cast<int>((brick / brick_dims[0]) % brick_dims[1]) * BRICK_SIZE - APRON,
+		static_cast<int>(brick / (brick_dims[0] * brick_dims[1])) * BRICK_SIZE - APRON
+	};
+	if (data_out) {
+		copy_brick(data, dims, origin, data_out);
+	}
+	if (segmentation && seg_out) {
+		const size_t slot_voxels = static_cast<size_t>(SLOT_SIZE) * SLOT_SIZE * SLOT_SIZE;
+		std::vector<uint8_t> ids(slot_voxels * segmentation->GetDataTypeSize());
+		copy_brick(segmentation, dims, origin, ids.data());
+		switch (segmentation->GetDataType()) {
+			vtkTemplateMacro(convert_ids(reinterpret_cast<const VTK_TT*>(ids.data()), slot_voxels,
+						seg_format.type, seg_out));
+			default:
+				throw std::runtime_error("Unsupported segmentation data type '"
+						+ std::to_string(segmentation->GetDataType()) + "'");
+		}
+	}
+}
+void BrickCache::upload_bricks(const std::vector<size_t> &bricks, const std::vector<size_t> &slots,
+		const bool upload_data, const bool upload_seg)
+{
+	const size_t slot_voxels = static_cast<size_t>(SLOT_SIZE) * SLOT_SIZE * SLOT_SIZE;
+	const size_t data_bytes = upload_data ? slot_voxels * data_format.bytes_per_voxel : 0;
+	const size_t seg_bytes = upload_seg ? slot_voxels * seg_format.bytes_per_voxel : 0;
+	std::vector<uint8_t> data_staging(UPLOAD_BATCH_SIZE * data_bytes);
+	std::vector<uint8_t> seg_staging(UPLOAD_BATCH_SIZE * seg_bytes);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t batch = 0; batch < bricks.size(); batch += UPLOAD_BATCH_SIZE) {
+		const size_t batch_size = std::min(UPLOAD_BATCH_SIZE, bricks.size() - batch);
+		parallel_for(0, batch_size, 1, [&](const size_t begin, const size_t end, const size_t) {
+			for (size_t i = begin; i < end; ++i) {
+				extract_brick(bricks[batch + i], upload_data ? data_staging.data() + i * data_bytes : nullptr,
+						upload_seg ? seg_staging.data() + i * seg_bytes : nullptr);
+			}
+		});
+		for (size_t i = 0; i < batch_size; ++i) {
+			const size_t s = slots[batch + i];
+			const int x = (s % atlas_slots[0]) * SLOT_SIZE;
+			const int y = ((s / atlas_slots[0]) % atlas_slots[1]) * SLOT_SIZE;
+			const int z = (s / (atlas_slots[0] * atlas_slots[1])) * SLOT_SIZE;
+			if (upload_data) {
+				glBindTexture(GL_TEXTURE_3D, data_atlas);
+				glTexSubImage3D(GL_TEXTURE_3D, 0, x, y, z, SLOT_SIZE, SLOT_SIZE, SLOT_SIZE,
+						data_format.pixel_format, data_format.type, data_staging.data() + i * data_bytes);
+			}
+			if (upload_seg) {
+				glBindTexture(GL_TEXTURE_3D, seg_atlas);
+				glTexSubImage3D(GL_TEXTURE_3D, 0, x, y, z, SLOT_SIZE, SLOT_SIZE, SLOT_SIZE,
+						seg_format.pixel_format, seg_format.type, seg_staging.data() + i * seg_bytes);
+			}
+		}
+	}
+}
+
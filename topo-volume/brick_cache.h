@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <vtkDataArray.h>
+#include "glt/gl_core_4_5.h"
+#include "occupancy_grid.h"
+#include "texture_format.h"
+
+/* Stores the volume and segmentation as fixed size bricks in texture atlases, for
+ * volumes too large to upload in one texture or to fit in the GPU memory budget.
+ * Each brick has a one voxel apron copied from its neighbors so interpolation
+ * within a brick matches the full volume. A page table texture maps each brick
+ * of the volume to its slot in the atlas, 0 meaning the brick isn't resident.
+ * Only the bricks overlapping occupied cells of the occupancy grid are made
+ * resident, when the atlas is full the least recently requested bricks are evicted.
+ */
+class BrickCache {
+public:
+	// Number of voxels along each axis of a brick, excluding the apron.
+	// Must be a multiple of the occupancy grid cell size
+	static const int BRICK_SIZE = 32;
+	static const int APRON = 1;
+	static const int SLOT_SIZE = BRICK_SIZE + 2 * APRON;
+
+private:
+	vtkDataArray *data, *segmentation;
+	std::array<int, 3> dims, brick_dims;
+	TextureFormat data_format, seg_format;
+	// The number of slots along each axis of the atlas
+	std::array<int, 3> atlas_slots;
+	GLuint data_atlas, seg_atlas, page_table;
+	// The atlas slot + 1 of each brick, 0 if the brick isn't resident
+	std::vector<uint32_t> pages;
+	// The brick in each slot, -1 if it's free, and when it was last requested
+	std::vector<int64_t> slot_brick;
+	std::vector<uint64_t> slot_last_used;
+	uint64_t update_count;
+	unsigned int debuglevel;
+
+public:
+	/* Setup the cache for the data and segmentation, the segmentation may be null.
+	 * The atlas is sized to hold as many bricks as fit in the memory budget, within
+	 * the max 3D texture size. The bricking stats are printed at debug level 1
+	 */
+	BrickCache(vtkDataArray *data, vtkDataArray *segmentation, const std::array<int, 3> &dims,
+			const TextureFormat &data_format, const TextureFormat &seg_format,
+			const size_t memory_budget, const int max_texture_size, const unsigned int debuglevel = 0);
+	BrickCache(const BrickCache&) = delete;
+	BrickCache& operator=(const BrickCache&) = delete;
+	/* Allocate the atlases and page table in the textures passed, which are owned
+	 * by the caller. seg_atlas is unused if there's no segmentation
+	 */
+	void allocate(GLuint data_atlas, GLuint seg_atlas, GLuint page_table);
+	/* Make the bricks overlapping occupied cells resident, evicting the least recently
+	 * requested bricks if needed, and upload the new bricks and page table
+	 */
+	void update(const OccupancyGrid &occupancy);
+	/* Check if the segmentation can be swapped for a new one without changing the
+	 * atlas layout, which requires the segmentation to use the same format
+	 */
+	bool can_replace_segmentation(vtkDataArray *segmentation, const TextureFormat &format) const;
+	// Swap in a new segmentation, re-uploading the ids of the resident bricks but not their data
+	void replace_segmentation(vtkDataArray *segmentation);
+	const std::array<int, 3>& get_atlas_slots() const;
+	// Get the size of the atlas textures in voxels
+	std::array<int, 3> get_atlas_dims() const;
+	size_t num_resident() const;
+
+private:
+	size_t num_bricks() const;
+	size_t num_slots() const;
+	/* Copy the brick's voxels and apron into out, converting the segment ids to the seg format.
+	 * Either output can be null to skip extracting it
+	 */
+	void extract_brick(const size_t brick, uint8_t *data_out, uint8_t *seg_out) const;
+	// Extract the bricks in parallel in batches and upload them to their slots
+	void upload_bricks(const std::vector<size_t> &bricks, const std::vector<size_t> &slots,
+			const bool upload_data, const bool upload_seg);
+};
+
@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <glm/ext.hpp>
+#include <vtkType.h>
+#include "parallel.h"
+#include "palette_coverage.h"
+#include "cpu_renderer.h"
+
+static const size_t N = CpuRenderer::PACKET_SIZE;
+// Number of entries in the opacity correction table
+static const size_t OPACITY_TABLE_SIZE = 4096;
+
+// The state of a packet of rays, in the volume's [0, 1] space
+struct RayPacket {
+	std::array<float, N> ox, oy, oz, dx, dy, dz;
+	std::array<float, N> t, t_enter, t_exit, dt, alpha_scale;
+	// The accumulated color and the sample taken this step, the sample's alpha is
+	// already corrected for the step size
+	std::array<float, N> r, g, b, a;
+	std::array<float, N> sr, sg, sb, sa;
+	// The sample position, and its macrocell and voxel this step
+	std::array<float, N> px, py, pz;
+	std::array<size_t, N> cell, voxel;
+	// 1 if the sample's macrocell is occupied and its segment is visible
+	std::array<uint8_t, N> occupied, visible;
+	std::array<uint8_t, N> active;
+};
+
+static float fract(const float x) {
+	return x - std::floor(x);
+}
+// The same pseudo-random jitter as the shader
+static float jitter_rand(const float x, const float y) {
+	return fract(std::sin(x * 12.9898f + y * 78.233f) * 43758.5453f);
+}
+static size_t voxel_index(const std::array<int, 3> &dims, const int x, const int y, const int z) {
+	return (static_cast<size_t>(z) * dims[1] + y) * dims[0] + x;
+}
+static int clamp_voxel(const float v, const int dim) {
+	return std::min(std::max(static_cast<int>(std::floor(v)), 0), dim - 1);
+}
+// Sample the data at p in [0, 1] like GL samples a 3D texture clamped to its edge
+template<typename T>
+static float sample_volume(const T *values, const std::array<int, 3> &dims, const bool linear, const glm::vec3 &p) {
+	if (!linear) {
+		return values[voxel_index(dims, clamp_voxel(p.x * dims[0], dims[0]),
+				clamp_voxel(p.y * dims[1], dims[1]), clamp_voxel(p.z * dims[2], dims[2]))];
+	}
+	const glm::vec3 v = p * glm::vec3(dims[0], dims[1], dims[2]) - glm::vec3(0.5f);
+	const glm::vec3 base = glm::floor(v);
+	const glm::vec3 f = v - base;
+	std::array<int, 2> xs, ys, zs;
+	for (int i = 0; i < 2; ++i) {
+		xs[i] = std::min(std::max(static_cast<int>(base.x) + i, 0), dims[0] - 1);
+		ys[i] = std::min(std::max(static_cast<int>(base.y) + i, 0), dims[1] - 1);
+		zs[i] = std::min(std::max(static_cast<int>(base.z) + i, 0), dims[2] - 1);
+	}
+	float z_vals[2];
+	for (int k = 0; k < 2; ++k) {
+		float y_vals[2];
+		for (int j = 0; j < 2; ++j) {
+			const float lo = values[voxel_index(dims, xs[0], ys[j], zs[k])];
+			const float hi = values[voxel_index(dims, xs[1], ys[j], zs[k])];
+			y_vals[j] = lo + f.x * (hi - lo);
+		}
+		z_vals[k] = y_vals[0] + f.y * (y_vals[1] - y_vals[0]);
+	}
+	return z_vals[0] + f.z * (z_vals[1] - z_vals[0]);
+}
+// Look up the palette at x in [0, 1] with linear filtering, like the palette texture
+static void sample_palette(const PaletteTable &table, const size_t palette, const float x, float *out) {
+	const size_t layer = std::min(palette, table.size() - 1);
+	float s = x * table.samples - 0.5f;
+	s = std::isfinite(s) ? std::min(std::max(s, 0.f), static_cast<float>(table.samples - 1)) : 0.f;
+	const size_t i0 = static_cast<size_t>(s);
+	const size_t i1 = std::min(i0 + 1, table.samples - 1);
+	const float f = s - i0;
+	const uint8_t *lo = table.rgba.data() + (layer * table.samples + i0) * 4;
+	const uint8_t *hi = table.rgba.data() + (layer * table.samples + i1) * 4;
+	for (size_t c = 0; c < 4; ++c) {
+		out[c] = (lo[c] + f * (hi[c] - lo[c])) / 255.f;
+	}
+}
+
+/* Tabulate the shader's opacity correction 1 - (1 - x)^step_scale over x in [0, 1], so
+ * it's a lookup instead of a pow per sample. The table has an extra entry at the end
+ * so lookups can always interpolate with the next entry
+ */
+static std::vector<float> build_opacity_table(const float step_scale) {
+	std::vector<float> table(OPACITY_TABLE_SIZE + 1);
+	for (size_t i = 0; i < OPACITY_TABLE_SIZE; ++i) {
+		table[i] = 1.f - std::pow(1.f - static_cast<float>(i) / (OPACITY_TABLE_SIZE - 1), step_scale);
+	}
+	table[OPACITY_TABLE_SIZE] = table[OPACITY_TABLE_SIZE - 1];
+	return table;
+}
+static float correct_opacity(const std::vector<float> &table, const float x) {
+	const float s = std::min(std::max(x, 0.f), 1.f) * (OPACITY_TABLE_SIZE - 1);
+	const size_t i = static_cast<size_t>(s);
+	return table[i] + (s - i) * (table[i + 1] - table[i]);
+}
+
+RenderView::RenderView() : proj(1), view(1), vol_transform(1), width(0), height(0), step_scale(1.f), frames(1) {}
+RenderView initial_view(const glm::vec3 &render_size, const int width, const int height) {
+	RenderView view;
+	view.width = width;
+	view.height = height;
+	view.proj = glm::perspective(glm::radians(65.f), static_cast<float>(width) / height, 0.1f, 2000.f);
+	view.view = glm::lookAt(glm::vec3(0.f, 0.f, render_size.z), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+	view.vol_transform = glm::translate(render_size * glm::vec3(-0.5f)) * glm::scale(render_size);
+	return view;
+}
+
+CpuRenderer::CpuRenderer(vtkDataArray *data, vtkDataArray *segmentation, const std::array<int, 3> &dims)
+	: data(data), segmentation(segmentation), dims(dims)
+{
+	const size_t num_voxels = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+	if (static_cast<size_t>(data->GetNumberOfTuples()) != num_voxels
+			|| (segmentation && static_cast<size_t>(segmentation->GetNumberOfTuples()) != num_voxels))
+	{
+		throw std::runtime_error("CPU renderer data and segmentation must match the volume dimensions");
+	}
+	// Match the value mapping of the volume's texture formats, 8 bit data is normalized
+	// to [0, 1] by GL and the integer formats are sampled with nearest filtering
+	switch (data->GetDataType()) {
+		case VTK_CHAR:
+		case VTK_UNSIGNED_CHAR:
+			value_scale = 1.f / 255.f;
+			value_bias = 0.f;
+			linear = true;
+			break;
+		case VTK_SHORT:
+		case VTK_UNSIGNED_SHORT:
+		case VTK_INT:
+		case VTK_FLOAT:
+			value_scale = 1.f / (data->GetRange()[1] - data->GetRange()[0]);
+			value_bias = -data->GetRange()[0];
+			linear = data->GetDataType() == VTK_FLOAT;
+			break;
+		default:
+			throw std::runtime_error("Unsupported VTK data type '" + std::to_string(data->GetDataType()) + "'");
+	}
+	build_occupancy_grid(data, segmentation, dims, occupancy_grid);
+}
+void CpuRenderer::set_classification(const PaletteTable &table, const std::vector<unsigned int> &selections,
+		const std::vector<unsigned int> &segment_palettes)
+{
+	palettes = table;
+	segment_table.assign(selections.size(), 0);
+	for (size_t i = 0; i < segment_table.size(); ++i) {
+		if (selections[i] != 0) {
+			const unsigned int palette = i < segment_palettes.size() ? segment_palettes[i] : 0;
+			segment_table[i] = static_cast<uint16_t>(std::min(palette + 1, 65535u));
+		}
+	}
+	const PaletteCoverage coverage(palettes.alpha(), palettes.samples, value_scale, value_bias);
+	occupancy_grid.update_occupied(selections, segment_palettes, coverage);
+}
+CpuImage CpuRenderer::render(const RenderView &view) const {
+	CpuImage image;
+	image.width = view.width;
+	image.height = view.height;
+	image.rgba.resize(static_cast<size_t>(view.width) * view.height * 4, 0.f);
+	if (palettes.size() == 0 || (segmentation && segment_table.empty()) || view.width <= 0 || view.height <= 0) {
+		return image;
+	}
+	void *ptr = data->GetVoidPointer(0);
+	// 8 bit data is uploaded as unsigned bytes so the signed values wrap the same way
+	switch (data->GetDataType()) {
+		case VTK_CHAR:
+		case VTK_UNSIGNED_CHAR:
+			dispatch_segmentation(static_cast<const uint8_t*>(ptr), view, image);
+			break;
+		case VTK_SHORT:
+			dispatch_segmentation(static_cast<const short*>(ptr), view, image);
+			break;
+		case VTK_UNSIGNED_SHORT:
+			dispatch_segmentation(static_cast<const unsigned short*>(ptr), view, image);
+			break;
+		case VTK_INT:
+			dispatch_segmentation(static_cast<const int*>(ptr), view, image);
+			break;
+		case VTK_FLOAT:
+			dispatch_segmentation(static_cast<const float*>(ptr), view, image);
+			break;
+	}
+	return image;
+}
+template<typename T>
+void CpuRenderer::dispatch_segmentation(const T *values, const RenderView &view, CpuImage &image) const {
+	if (!segmentation) {
+		render_kernel(values, static_cast<const uint8_t*>(nullptr), view, image);
+		return;
+	}
+	void *ptr = segmentation->GetVoidPointer(0);
+	switch (segmentation->GetDataType()) {
+		vtkTemplateMacro(render_kernel(values, static_cast<const VTK_TT*>(ptr), view, image));
+		default:
+			throw std::runtime_error("Unsupported segmentation data type '"
+					+ std::to_string(segmentation->GetDataType()) + "'");
+	}
+}
+template<typename T, typename S>
+void CpuRenderer::render_kernel(const T *values, const S *segments, const RenderView &view, CpuImage &image) const {
+	const glm::mat4 inv_proj_view_vol = glm::inverse(view.proj * view.view * view.vol_transform);
+	const glm::vec3 eye = glm::vec3(glm::inverse(view.vol_transform) * glm::inverse(view.view)[3]);
+	const glm::vec3 vol_dim(dims[0], dims[1], dims[2]);
+	const std::array<int, 3> &grid_dims = occupancy_grid.grid_dims;
+	const int cell_size = OccupancyGrid::CELL_SIZE;
+	const float frame_weight = 1.f / std::max(view.frames, 1);
+	const std::vector<float> opacity_table = build_opacity_table(view.step_scale);
+	const size_t table_size = segment_table.size();
+
+	const int tiles_x = (view.width + TILE_SIZE - 1) / TILE_SIZE;
+	const int tiles_y = (view.height + TILE_SIZE - 1) / TILE_SIZE;
+	parallel_for_stealing(static_cast<size_t>(tiles_x) * tiles_y, [&](const size_t tile, const size_t) {
+		const int tile_x = static_cast<int>(tile % tiles_x) * TILE_SIZE;
+		const int tile_y = static_cast<int>(tile / tiles_x) * TILE_SIZE;
+		RayPacket rays = {};
+		for (int frame = 0; frame < std::max(view.frames, 1); ++frame) {
+			for (int row = tile_y; row < std::min(tile_y + TILE_SIZE, view.height); ++row) {
+				for (int packet_x = tile_x; packet_x < std::min(tile_x + TILE_SIZE, view.width); packet_x += N) {
+					// Setup the rays through each pixel's center, rows are flipped to GL's window coordinates
+					rays = RayPacket{};
+					bool any_active = false;
+					for (size_t l = 0; l < N; ++l) {
+						const int x = packet_x + static_cast<int>(l);
+						if (x >= view.width) {
+							continue;
+						}
+						const glm::vec2 frag(x + 0.5f, view.height - row - 0.5f);
+						const glm::vec2 ndc = frag / glm::vec2(view.width, view.height) * 2.f - 1.f;
+						const glm::vec4 far_h = inv_proj_view_vol * glm::vec4(ndc, 1.f, 1.f);
+						const glm::vec3 dir = glm::normalize(glm::vec3(far_h) / far_h.w - eye);
+
+						const glm::vec3 inv_dir = 1.f / dir;
+						const glm::vec3 tmin_tmp = -eye * inv_dir;
+						const glm::vec3 tmax_tmp = (glm::vec3(1) - eye) * inv_dir;
+						const glm::vec3 tmin = glm::min(tmin_tmp, tmax_tmp);
+						const glm::vec3 tmax = glm::max(tmin_tmp, tmax_tmp);
+						float t_enter = std::max(0.f, std::max(tmin.x, std::max(tmin.y, tmin.z)));
+						const float t_exit = std::min(tmax.x, std::min(tmax.y, tmax.z));
+						const glm::vec3 dt_vec = 1.f / (vol_dim * glm::abs(dir));
+						const float base_dt = std::min(dt_vec.x, std::min(dt_vec.y, dt_vec.z));
+						const float dt = base_dt * view.step_scale;
+						t_enter += dt * fract(jitter_rand(frag.x, frag.y) + frame * 0.61803398875f);
+						if (!(t_enter <= t_exit)) {
+							continue;
+						}
+						rays.ox[l] = eye.x;
+						rays.oy[l] = eye.y;
+						rays.oz[l] = eye.z;
+						rays.dx[l] = dir.x;
+						rays.dy[l] = dir.y;
+						rays.dz[l] = dir.z;
+						rays.t[l] = t_enter;
+						rays.t_enter[l] = t_enter;
+						rays.t_exit[l] = t_exit;
+						rays.dt[l] = dt;
+						rays.alpha_scale[l] = std::pow(base_dt, 0.4f);
+						rays.active[l] = 1;
+						any_active = true;
+					}
+
+					while (any_active) {
+						// Find each ray's sample position and its macrocell and voxel. Inactive
+						// lanes are processed too and masked out, so the lane loops don't branch
+						for (size_t l = 0; l < N; ++l) {
+							rays.px[l] = rays.ox[l] + rays.t[l] * rays.dx[l];
+							rays.py[l] = rays.oy[l] + rays.t[l] * rays.dy[l];
+							rays.pz[l] = rays.oz[l] + rays.t[l] * rays.dz[l];
+							const int vx = std::min(std::max(static_cast<int>(rays.px[l] * vol_dim.x), 0), dims[0] - 1);
+							const int vy = std::min(std::max(static_cast<int>(rays.py[l] * vol_dim.y), 0), dims[1] - 1);
+							const int vz = std::min(std::max(static_cast<int>(rays.pz[l] * vol_dim.z), 0), dims[2] - 1);
+							rays.voxel[l] = voxel_index(dims, vx, vy, vz);
+							rays.cell[l] = voxel_index(grid_dims, vx / cell_size, vy / cell_size, vz / cell_size);
+						}
+						// The volume, segment and palette lookups are gathers so they're done
+						// ray by ray, without skipping lanes
+						for (size_t l = 0; l < N; ++l) {
+							rays.occupied[l] = occupancy_grid.occupied[rays.cell[l]];
+							size_t palette = 0;
+							uint8_t visible = 1;
+							if (segments) {
+								const int64_t id = static_cast<int64_t>(segments[rays.voxel[l]]);
+								const size_t s = static_cast<size_t>(std::max(id, int64_t{0}));
+								const uint16_t entry = segment_table[std::min(s, table_size - 1)];
+								visible = s < table_size && entry != 0;
+								palette = std::max(entry, uint16_t{1}) - 1;
+							}
+							rays.visible[l] = visible;
+							const glm::vec3 p(rays.px[l], rays.py[l], rays.pz[l]);
+							const float value = sample_volume(values, dims, linear, p) * value_scale + value_bias;
+							float rgba[4];
+							sample_palette(palettes, palette, value, rgba);
+							rays.sr[l] = rgba[0];
+							rays.sg[l] = rgba[1];
+							rays.sb[l] = rgba[2];
+							rays.sa[l] = correct_opacity(opacity_table, rgba[3] * rays.alpha_scale[l]);
+						}
+
+						// Composite the samples and step the rays across the packet. Rays in an empty
+						// macrocell leap over it, staying on the ray's sample positions
+						any_active = false;
+						for (size_t l = 0; l < N; ++l) {
+							const bool active = rays.active[l] != 0;
+							const bool empty = rays.occupied[l] == 0;
+							const float cell_x = static_cast<float>(rays.cell[l] % grid_dims[0]);
+							const float cell_y = static_cast<float>(rays.cell[l] / grid_dims[0] % grid_dims[1]);
+							const float cell_z = static_cast<float>(rays.cell[l] / (static_cast<size_t>(grid_dims[0]) * grid_dims[1]));
+							const float exit_x = std::min((cell_x + (rays.dx[l] > 0.f)) * cell_size, vol_dim.x) / vol_dim.x;
+							const float exit_y = std::min((cell_y + (rays.dy[l] > 0.f)) * cell_size, vol_dim.y) / vol_dim.y;
+							const float exit_z = std::min((cell_z + (rays.dz[l] > 0.f)) * cell_size, vol_dim.z) / vol_dim.z;
+							const float t_cell = std::min((exit_x - rays.ox[l]) / rays.dx[l],
+									std::min((exit_y - rays.oy[l]) / rays.dy[l], (exit_z - rays.oz[l]) / rays.dz[l]));
+							const float t_leap = std::max(rays.t[l] + rays.dt[l], rays.t_enter[l]
+									+ std::ceil((t_cell - rays.t_enter[l]) / rays.dt[l]) * rays.dt[l]);
+
+							const float w = active && !empty && rays.visible[l] ? (1.f - rays.a[l]) * rays.sa[l] : 0.f;
+							rays.r[l] += w * rays.sr[l];
+							rays.g[l] += w * rays.sg[l];
+							rays.b[l] += w * rays.sb[l];
+							rays.a[l] += w;
+							rays.t[l] = empty ? t_leap : rays.t[l] + rays.dt[l];
+							rays.active[l] = active && rays.t[l] < rays.t_exit[l] && rays.a[l] < 0.97f;
+							any_active = any_active || rays.active[l];
+						}
+					}
+
+					for (size_t l = 0; l < N && packet_x + static_cast<int>(l) < view.width; ++l) {
+						float *px = image.rgba.data() + (static_cast<size_t>(row) * view.width + packet_x + l) * 4;
+						px[0] += frame_weight * rays.r[l];
+						px[1] += frame_weight * rays.g[l];
+						px[2] += frame_weight * rays.b[l];
+						px[3] += frame_weight * rays.a[l];
+					}
+				}
+			}
+		}
+	});
+}
+void write_ppm(const std::string &file, const CpuImage &image, const glm::vec3 &background) {
+	std::ofstream fout(file.c_str(), std::ios::binary);
+	if (!fout) {
+		throw std::runtime_error("Failed to open '" + file + "' to write the image");
+	}
+	fout << "P6\n" << image.width << " " << image.height << "\n255\n";
+	std::vector<uint8_t> row(static_cast<size_t>(image.width) * 3);
+	for (int y = 0; y < image.height; ++y) {
+		for (int x = 0; x < image.width; ++x) {
+			const float *px = image.rgba.data() + (static_cast<size_t>(y) * image.width + x) * 4;
+			for (int c = 0; c < 3; ++c) {
+				const float v = px[c] + (1.f - px[3]) * background[c];
+				row[x * 3 + c] = static_cast<uint8_t>(std::min(std::max(v, 0.f), 1.f) * 255.f + 0.5f);
+			}
+		}
+		fout.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+	if (!fout) {
+		throw std::runtime_error("Failed to write the image to '" + file + "'");
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vtkDataArray.h>
+#include "occupancy_grid.h"
+#include "palette_table.h"
+
+// The camera and sampling settings to render an image with on the CPU
+struct RenderView {
+	glm::mat4 proj, view;
+	// Transform from the volume's [0, 1] space to world space
+	glm::mat4 vol_transform;
+	int width, height;
+	// Multiplier for the sampling step, as for the GPU renderer
+	float step_scale;
+	// The number of frames with different ray jitter averaged to make the image
+	int frames;
+
+	RenderView();
+};
+
+/* Get the viewer's starting view of a volume with the world space size: the volume
+ * is centered at the origin and looked at down the z axis
+ */
+RenderView initial_view(const glm::vec3 &render_size, const int width, const int height);
+
+// An image with premultiplied RGBA pixels, stored top row first
+struct CpuImage {
+	int width, height;
+	std::vector<float> rgba;
+};
+
+/* Renders the volume with ray casting on the CPU, reproducing the GPU renderer's
+ * compositing mode: the rays are cast through the volume's box with a jittered
+ * start and the selected segments are composited front to back through their
+ * palettes, skipping empty macrocells. Pre-integration and isosurfaces are not
+ * supported. Tiles of the image are rendered in parallel with work stealing, and
+ * each tile is marched as packets of rays stored as structures of arrays. All lanes
+ * of a packet are processed each step and masked, so the compositing and stepping
+ * loops are branch-free and vectorize; the step size opacity correction is a table
+ * built once per render.
+ */
+class CpuRenderer {
+	vtkDataArray *data, *segmentation;
+	std::array<int, 3> dims;
+	// Map the data values to the palette coordinates the same way the shader does
+	float value_scale, value_bias;
+	// Integer textures are sampled with nearest filtering on the GPU, the others are linear
+	bool linear;
+	OccupancyGrid occupancy_grid;
+	// The palette + 1 of each selected segment, or 0 for unselected segments
+	std::vector<uint16_t> segment_table;
+	PaletteTable palettes;
+
+public:
+	// The number of pixels along each side of a tile
+	static const int TILE_SIZE = 16;
+	// The number of rays in a packet, each packet is a row of a tile
+	static const int PACKET_SIZE = 8;
+
+	/* The data and segmentation arrays must have dims voxels, the segmentation can
+	 * be null in which case the whole volume is one segment using palette 0.
+	 * Supports the data types the GPU renderer does
+	 */
+	CpuRenderer(vtkDataArray *data, vtkDataArray *segmentation, const std::array<int, 3> &dims);
+	/* Set the palettes, and the selection and palette of each segment as in the
+	 * volume's segmentation_selections and segmentation_palettes. Nothing is drawn
+	 * until the palettes are set
+	 */
+	void set_classification(const PaletteTable &palettes, const std::vector<unsigned int> &selections,
+			const std::vector<unsigned int> &segment_palettes);
+	CpuImage render(const RenderView &view) const;
+
+private:
+	template<typename T, typename S>
+	void render_kernel(const T *values, const S *segments, const RenderView &view, CpuImage &image) const;
+	template<typename T>
+	void dispatch_segmentation(const T *values, const RenderView &view, CpuImage &image) const;
+};
+
+// Write the image as a binary PPM, compositing it over the background color
+void write_ppm(const std::string &file, const CpuImage &image, const glm::vec3 &background = glm::vec3(0));
+
@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include "imgui-1.49/imgui.h"
+#include "frame_timeline.h"
+
+const size_t FrameTimeline::MAX_ZONES;
+const size_t FrameTimeline::QUERY_FRAMES;
+const size_t FrameTimeline::HISTORY;
+
+static const uint64_t NO_FRAME = std::numeric_limits<uint64_t>::max();
+
+// Get the p'th percentile of the values, reordering them
+static float percentile(std::vector<float> &values, const float p) {
+	if (values.empty()) {
+		return 0.f;
+	}
+	const size_t n = std::min(static_cast<size_t>(p * values.size()), values.size() - 1);
+	std::nth_element(values.begin(), values.begin() + n, values.end());
+	return values[n];
+}
+
+FrameTimeline::Zone::Zone(FrameTimeline &timeline, const size_t id) : timeline(timeline), id(id) {
+	timeline.begin_zone(id);
+}
+FrameTimeline::Zone::~Zone() {
+	timeline.end_zone(id);
+}
+FrameTimeline::ZoneSample::ZoneSample() : cpu_start(-1.f), cpu_ms(-1.f), gpu_start(-1.f), gpu_ms(-1.f) {}
+
+FrameTimeline::FrameTimeline()
+	: history(HISTORY), frame_index(NO_FRAME), gpu_timing(false), epoch(std::chrono::steady_clock::now()),
+	frame_start(epoch), dump_frames(120), chart_zone(0)
+{
+	glGenQueries(queries.size(), queries.data());
+	query_frame.fill(NO_FRAME);
+	for (auto &issued : query_issued) {
+		issued.fill(false);
+	}
+	for (auto &f : history) {
+		f.index = NO_FRAME;
+	}
+	trace_file.fill('\0');
+	std::strncpy(trace_file.data(), "frame_trace.json", trace_file.size() - 1);
+}
+FrameTimeline::~FrameTimeline() {
+	glDeleteQueries(queries.size(), queries.data());
+}
+size_t FrameTimeline::add_zone(const std::string &name) {
+	if (zone_names.size() == MAX_ZONES) {
+		throw std::runtime_error("Can't add zone " + name + ", the frame timeline is full");
+	}
+	zone_names.push_back(name);
+	return zone_names.size() - 1;
+}
+void FrameTimeline::begin_frame() {
+	read_queries();
+	++frame_index;
+	frame_start = std::chrono::steady_clock::now();
+
+	Frame &f = history[frame_index % HISTORY];
+	f.index = frame_index;
+	f.start = std::chrono::duration_cast<std::chrono::duration<double>>(frame_start - epoch).count();
+	f.cpu_ms = -1.f;
+	f.zones.fill(ZoneSample());
+
+	// If this frame's queries are still in flight skip timing it on the GPU, rather than waiting
+	const size_t slot = frame_index % QUERY_FRAMES;
+	gpu_timing = query_frame[slot] == NO_FRAME;
+	if (gpu_timing) {
+		query_issued[slot].fill(false);
+		glGetInteger64v(GL_TIMESTAMP, &f.gpu_start_ns);
+	}
+}
+void FrameTimeline::end_frame() {
+	using namespace std::chrono;
+	Frame &f = history[frame_index % HISTORY];
+	f.cpu_ms = duration_cast<duration<float, std::milli>>(steady_clock::now() - frame_start).count();
+	const size_t slot = frame_index % QUERY_FRAMES;
+	if (gpu_timing && std::find(query_issued[slot].begin(), query_issued[slot].end(), true)
+			!= query_issued[slot].end())
+	{
+		query_frame[slot] = frame_index;
+	}
+	gpu_timing = false;
+}
+void FrameTimeline::begin_zone(const size_t id) {
+	zone_start[id] = std::chrono::steady_clock::now();
+	const ZoneSample &z = history[frame_index % HISTORY].zones[id];
+	if (gpu_timing && z.cpu_ms < 0.f) {
+		glQueryCounter(query(frame_index % QUERY_FRAMES, id, 0), GL_TIMESTAMP);
+	}
+}
+void FrameTimeline::end_zone(const size_t id) {
+	using namespace std::chrono;
+	const auto now = steady_clock::now();
+	ZoneSample &z = history[frame_index % HISTORY].zones[id];
+	const float ms = duration_cast<duration<float, std::milli>>(now - zone_start[id]).count();
+	if (z.cpu_ms < 0.f) {
+		z.cpu_start = duration_cast<duration<float, std::milli>>(zone_start[id] - frame_start).count();
+		z.cpu_ms = ms;
+		if (gpu_timing) {
+			const size_t slot = frame_index % QUERY_FRAMES;
+			glQueryCounter(query(slot, id, 1), GL_TIMESTAMP);
+			query_issued[slot][id] = true;
+		}
+	} else {
+		z.cpu_ms += ms;
+	}
+}
+void FrameTimeline::write_trace(const std::string &file, const size_t num_frames) const {
+	std::ofstream fout(file.c_str());
+	if (!fout) {
+		throw std::runtime_error("Failed to open " + file + " to write the trace");
+	}
+	// Times in the trace are in microseconds. The zone names are ours so they don't need escaping
+	fout << std::fixed << std::setprecision(3);
+	fout << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+		<< "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"CPU\"}},\n"
+		<< "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"GPU\"}}";
+	const size_t count = std::min(std::min(num_frames, HISTORY),
+			frame_index == NO_FRAME ? size_t(0) : static_cast<size_t>(frame_index + 1));
+	for (size_t i = 0; i < count; ++i) {
+		const Frame &f = history[(frame_index + 1 + HISTORY - count + i) % HISTORY];
+		// Skip the frame being recorded
+		if (f.index == NO_FRAME || f.cpu_ms < 0.f) {
+			continue;
+		}
+		const double start_us = f.start * 1e6;
+		fout << ",\n{\"name\": \"Frame " << f.index << "\", \"cat\": \"frame\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0"
+			<< ", \"ts\": " << start_us << ", \"dur\": " << f.cpu_ms * 1e3 << "}";
+		for (size_t z = 0; z < zone_names.size(); ++z) {
+			const ZoneSample &s = f.zones[z];
+			if (s.cpu_ms >= 0.f) {
+				fout << ",\n{\"name\": \"" << zone_names[z] << "\", \"cat\": \"cpu\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0"
+					<< ", \"ts\": " << start_us + s.cpu_start * 1e3 << ", \"dur\": " << s.cpu_ms * 1e3 << "}";
+			}
+			if (s.gpu_ms >= 0.f) {
+				fout << ",\n{\"name\": \"" << zone_names[z] << "\", \"cat\": \"gpu\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1"
+					<< ", \"ts\": " << start_us + s.gpu_start * 1e3 << ", \"dur\": " << s.gpu_ms * 1e3 << "}";
+			}
+		}
+	}
+	fout << "\n]}\n";
+	if (!fout) {
+		throw std::runtime_error("Failed to write the trace to " + file);
+	}
+}
+void FrameTimeline::draw_ui() {
+	if (!ImGui::Begin("Frame Timeline")) {
+		ImGui::End();
+		return;
+	}
+	// Gather the times of the frames we have, oldest first. Missing zones are charted as 0
+	std::vector<float> frame_ms;
+	std::vector<std::vector<float>> cpu_chart(zone_names.size()), gpu_chart(zone_names.size());
+	std::vector<std::vector<float>> cpu_times(zone_names.size()), gpu_times(zone_names.size());
+	if (frame_index != NO_FRAME) {
+		const size_t count = std::min(HISTORY, static_cast<size_t>(frame_index + 1));
+		for (size_t i = 0; i < count; ++i) {
+			const Frame &f = history[(frame_index + 1 + HISTORY - count + i) % HISTORY];
+			if (f.cpu_ms < 0.f) {
+				continue;
+			}
+			frame_ms.push_back(f.cpu_ms);
+			for (size_t z = 0; z < zone_names.size(); ++z) {
+				const ZoneSample &s = f.zones[z];
+				cpu_chart[z].push_back(std::max(s.cpu_ms, 0.f));
+				gpu_chart[z].push_back(std::max(s.gpu_ms, 0.f));
+				if (s.cpu_ms >= 0.f) {
+					cpu_times[z].push_back(s.cpu_ms);
+				}
+				if (s.gpu_ms >= 0.f) {
+					gpu_times[z].push_back(s.gpu_ms);
+				}
+			}
+		}
+	}
+	{
+		std::vector<float> sorted = frame_ms;
+		ImGui::Text("Frame CPU p50 %.2f ms, p95 %.2f ms, p99 %.2f ms over %lu frames",
+				percentile(sorted, 0.5f), percentile(sorted, 0.95f), percentile(sorted, 0.99f),
+				static_cast<unsigned long>(frame_ms.size()));
+	}
+
+	if (!zone_names.empty()) {
+		std::vector<const char*> names;
+		for (const auto &n : zone_names) {
+			names.push_back(n.c_str());
+		}
+		chart_zone = std::min(std::max(chart_zone, 0), static_cast<int>(zone_names.size()) - 1);
+		ImGui::Combo("Zone", &chart_zone, names.data(), static_cast<int>(names.size()));
+		char overlay[128];
+		std::vector<float> sorted = cpu_times[chart_zone];
+		std::snprintf(overlay, sizeof(overlay), "p50 %.2f p95 %.2f p99 %.2f ms", percentile(sorted, 0.5f),
+				percentile(sorted, 0.95f), percentile(sorted, 0.99f));
+		ImGui::PlotLines("CPU", cpu_chart[chart_zone].data(), static_cast<int>(cpu_chart[chart_zone].size()), 0, overlay,
+				0.f, FLT_MAX, ImVec2(0, 60));
+		sorted = gpu_times[chart_zone];
+		std::snprintf(overlay, sizeof(overlay), "p50 %.2f p95 %.2f p99 %.2f ms", percentile(sorted, 0.5f),
+				percentile(sorted, 0.95f), percentile(sorted, 0.99f));
+		ImGui::PlotLines("GPU", gpu_chart[chart_zone].data(), static_cast<int>(gpu_chart[chart_zone].size()), 0, overlay,
+				0.f, FLT_MAX, ImVec2(0, 60));
+	}
+
+	ImGui::Columns(7, "zones");
+	ImGui::Text("Zone"); ImGui::NextColumn();
+	ImGui::Text("CPU p50"); ImGui::NextColumn();
+	ImGui::Text("CPU p95"); ImGui::NextColumn();
+	ImGui::Text("CPU p99"); ImGui::NextColumn();
+	ImGui::Text("GPU p50"); ImGui::NextColumn();
+	ImGui::Text("GPU p95"); ImGui::NextColumn();
+	ImGui::Text("GPU p99"); ImGui::NextColumn();
+	ImGui::Separator();
+	for (size_t z = 0; z < zone_names.size(); ++z) {
+		ImGui::Text("%s", zone_names[z].c_str()); ImGui::NextColumn();
+		for (auto *times : {&cpu_times[z], &gpu_times[z]}) {
+			for (const float p : {0.5f, 0.95f, 0.99f}) {
+				ImGui::Text("%.2f", percentile(*times, p)); ImGui::NextColumn();
+			}
+		}
+	}
+	ImGui::Columns(1);
+	ImGui::Separator();
+
+	ImGui::InputInt("Frames", &dump_frames);
+	dump_frames = std::min(std::max(dump_frames, 1), static_cast<int>(HISTORY));
+	ImGui::InputText("Trace File", trace_file.data(), trace_file.size());
+	if (ImGui::Button("Dump Trace")) {
+		try {
+			write_trace(trace_file.data(), dump_frames);
+			dump_status = std::string("Wrote ") + trace_file.data();
+		} catch (const std::exception &e) {
+			dump_status = e.what();
+		}
+	}
+	if (!dump_status.empty()) {
+		ImGui::TextWrapped("%s", dump_status.c_str());
+	}
+	ImGui::End();
+}
+void FrameTimeline::read_queries() {
+	// Read back the frames that are ready in the order they were issued. Timestamps
+	// complete in order so once a frame isn't ready the later ones won't be either
+	for (size_t i = 1; i <= QUERY_FRAMES; ++i) {
+		const size_t slot = (frame_index + i) % QUERY_FRAMES;
+		if (query_frame[slot] == NO_FRAME) {
+			continue;
+		}
+		bool ready = true;
+		for (size_t z = 0; z < MAX_ZONES && ready; ++z) {
+			if (query_issued[slot][z]) {
+				GLint available = 0;
+				glGetQueryObjectiv(query(slot, z, 1), GL_QUERY_RESULT_AVAILABLE, &available);
+				ready = available != 0;
+			}
+		}
+		if (!ready) {
+			break;
+		}
+		Frame *f = find_frame(query_frame[slot]);
+		for (size_t z = 0; z < MAX_ZONES && f; ++z) {
+			if (!query_issued[slot][z]) {
+				continue;
+			}
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(query(slot, z, 0), GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(query(slot, z, 1), GL_QUERY_RESULT, &end);
+			f->zones[z].gpu_start = (static_cast<GLint64>(begin) - f->gpu_start_ns) / 1e6f;
+			f->zones[z].gpu_ms = (end - begin) / 1e6f;
+		}
+		query_frame[slot] = NO_FRAME;
+	}
+}
+FrameTimeline::Frame* FrameTimeline::find_frame(const uint64_t index) {
+	Frame &f = history[index % HISTORY];
+	return f.index == index ? &f : nullptr;
+}
+GLuint FrameTimeline::query(const size_t slot, const size_t zone, const size_t end) const {
+	return queries[(slot * MAX_ZONES + zone) * 2 + end];
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "glt/gl_core_4_5.h"
+
+/* Times named zones of each frame on the CPU and GPU to attribute frame time and
+ * stutter. The GPU side of a zone is timed with timestamp queries from a ring of
+ * QUERY_FRAMES frames, which are read back a few frames later so we never stall
+ * waiting on them; if a frame's queries would reuse ones still in flight its GPU
+ * times are skipped. The last HISTORY frames are kept for the percentile charts
+ * and can be dumped as a Chrome trace.
+ */
+class FrameTimeline {
+public:
+	static const size_t MAX_ZONES = 16;
+	static const size_t QUERY_FRAMES = 4;
+	static const size_t HISTORY = 600;
+
+	// Times a zone for the scope it's in
+	class Zone {
+		FrameTimeline &timeline;
+		size_t id;
+
+	public:
+		Zone(FrameTimeline &timeline, const size_t id);
+		~Zone();
+		Zone(const Zone&) = delete;
+		Zone& operator=(const Zone&) = delete;
+	};
+
+private:
+	// Times of a zone in ms relative to the frame's start on the CPU clock, negative if
+	// the zone didn't run or its GPU time wasn't measured
+	struct ZoneSample {
+		float cpu_start, cpu_ms, gpu_start, gpu_ms;
+
+		ZoneSample();
+	};
+	struct Frame {
+		uint64_t index;
+		// Start time relative to the timeline's creation in seconds
+		double start;
+		float cpu_ms;
+		// The GPU clock at the start of the frame, to place the GPU times on the CPU clock
+		GLint64 gpu_start_ns;
+		std::array<ZoneSample, MAX_ZONES> zones;
+	};
+
+	std::vector<std::string> zone_names;
+	// The begin and end timestamp queries of each zone for each frame in the ring
+	std::array<GLuint, QUERY_FRAMES * MAX_ZONES * 2> queries;
+	// The frame using each set of queries, or NO_FRAME if they're free
+	std::array<uint64_t, QUERY_FRAMES> query_frame;
+	std::array<std::array<bool, MAX_ZONES>, QUERY_FRAMES> query_issued;
+	std::vector<Frame> history;
+	uint64_t frame_index;
+	bool gpu_timing;
+	std::chrono::steady_clock::time_point epoch, frame_start;
+	std::array<std::chrono::steady_clock::time_point, MAX_ZONES> zone_start;
+
+	// The number of frames and trace file name to dump from the UI
+	int dump_frames;
+	std::array<char, 256> trace_file;
+	std::string dump_status;
+	int chart_zone;
+
+public:
+	FrameTimeline();
+	~FrameTimeline();
+	FrameTimeline(const FrameTimeline&) = delete;
+	FrameTimeline& operator=(const FrameTimeline&) = delete;
+	// Add a zone to time, returning its id. At most MAX_ZONES can be added
+	size_t add_zone(const std::string &name);
+	/* Start timing a frame, reading back any GPU times that are ready. Zones must be
+	 * timed between begin_frame and end_frame
+	 */
+	void begin_frame();
+	void end_frame();
+	/* Time a zone between begin_zone and end_zone. A zone can't be nested in itself, and
+	 * if it runs more than once in a frame its CPU times are summed and only the first
+	 * run is timed on the GPU
+	 */
+	void begin_zone(const size_t id);
+	void end_zone(const size_t id);
+	/* Write the last num_frames frames as Chrome trace events, with the CPU and GPU
+	 * zones on separate tracks. Frames whose GPU times weren't read back yet only have
+	 * their CPU zones. Throws if the file can't be written
+	 */
+	void write_trace(const std::string &file, const size_t num_frames) const;
+	// Draw the rolling zone charts with their p50/p95/p99 times and the trace dump options
+	void draw_ui();
+
+private:
+	// Read back the GPU times of the frames whose queries have finished
+	void read_queries();
+	Frame* find_frame(const uint64_t index);
+	GLuint query(const size_t slot, const size_t zone, const size_t end) const;
+};
+
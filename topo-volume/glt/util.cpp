@@ -104,10 +104,24 @@ int get_file_num(const std::vector<char> &log){
 	//std::string file_no{log.begin(), paren};
 	return 0;
 }
-GLint glt::load_shader(GLenum type, const std::string &file){
+GLint glt::load_shader(GLenum type, const std::string &file, const std::vector<std::string> &defines){
 	GLuint shader = glCreateShader(type);
 	std::vector<std::string> file_names;
 	std::string src = glt::load_shader_file(file, file_names);
+	if (!defines.empty()){
+		// The defines must come after the #version directive, and we reset the line
+		// number after them so errors still point to the right line in the file
+		size_t version = src.find("#version");
+		size_t insert_at = version == std::string::npos ? 0 : src.find("\n", version) + 1;
+		const size_t line_no = std::count_if(src.begin(), src.begin() + insert_at,
+				[](const char &c){ return c == '\n'; });
+		std::string define_src;
+		for (const auto &d : defines){
+			define_src += "#define " + d + "\n";
+		}
+		define_src += "#line " + std::to_string(line_no + 1) + " 0\n";
+		src.insert(insert_at, define_src);
+	}
 	const char *csrc = src.c_str();
 	glShaderSource(shader, 1, &csrc, 0);
 	glCompileShader(shader);
@@ -149,10 +163,11 @@ GLint glt::load_shader(GLenum type, const std::string &file){
 	}
 	return shader;
 }
-GLint glt::load_program(const std::vector<std::pair<GLenum, std::string>> &shader_files){
+GLint glt::load_program(const std::vector<std::pair<GLenum, std::string>> &shader_files,
+		const std::vector<std::string> &defines){
 	std::vector<GLuint> shaders;
 	for (const auto &s : shader_files){
-		GLint h = load_shader(std::get<0>(s), std::get<1>(s));
+		GLint h = load_shader(std::get<0>(s), std::get<1>(s), defines);
 		if (h == -1){
 			std::cout << "Error loading shader program: A required shader failed to compile, aborting\n";
 			for (GLuint g : shaders){
@@ -42,12 +42,15 @@ std::string get_file_content(const std::string &fname);
 // in the #line directive
 std::string load_shader_file(const std::string &fname, std::vector<std::string> &file_names);
 // Load a GLSL shader from the file. Returns -1 if loading fails and prints
-// out the compilation errors
-GLint load_shader(GLenum type, const std::string &file);
+// out the compilation errors. The defines are inserted after the #version
+// directive as #define <define>, e.g. "USE_FOO" or "NUM_FOO 4"
+GLint load_shader(GLenum type, const std::string &file, const std::vector<std::string> &defines = {});
 // Load a GLSL shader program from the shader files specified. The pair
-// to specify a shader is { shader type, shader file }
+// to specify a shader is { shader type, shader file }. The defines are
+// passed to each shader, see load_shader
 // Returns -1 if program creation fails
-GLint load_program(const std::vector<std::pair<GLenum, std::string>> &shader_files);
+GLint load_program(const std::vector<std::pair<GLenum, std::string>> &shader_files,
+		const std::vector<std::string> &defines = {});
 /*
  * Load an image into a 2D texture, creating a new texture id
  * The texture unit desired for this texture should be set active
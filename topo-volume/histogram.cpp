@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vtkType.h>
+#include "parallel.h"
+#include "histogram.h"
+
+// Voxels are binned in small batches so computing the bin indices is a tight
+// loop the compiler can vectorize, separate from scattering the counts
+static const size_t BATCH_SIZE = 256;
+// Number of voxels each parallel task processes
+static const size_t TASK_SIZE = 1 << 20;
+// If per thread bins would use more memory than this we count into shared atomic bins
+static const size_t MAX_PRIVATE_BIN_BYTES = size_t(256) * 1024 * 1024;
+
+template<typename T>
+static void compute_bins(const T *data, const size_t count, const float value_min,
+		const float bin_scale, const int32_t max_bin, int32_t *bin_idx)
+{
+	for (size_t i = 0; i < count; ++i) {
+		const int32_t b = static_cast<int32_t>((static_cast<float>(data[i]) - value_min) * bin_scale);
+		bin_idx[i] = std::min(std::max(b, int32_t{0}), max_bin);
+	}
+}
+// Read the segment ids as int64 so the kernel doesn't depend on the id type
+template<typename S>
+static void read_segments(const S *seg, const size_t count, int64_t *out) {
+	for (size_t i = 0; i < count; ++i) {
+		out[i] = static_cast<int64_t>(seg[i]);
+	}
+}
+void read_segments(vtkDataArray *segmentation, const size_t begin, const size_t count, int64_t *out) {
+	if (!segmentation) {
+		std::fill(out, out + count, 0);
+		return;
+	}
+	void *ptr = segmentation->GetVoidPointer(begin);
+	switch (segmentation->GetDataType()) {
+		vtkTemplateMacro(read_segments(static_cast<const VTK_TT*>(ptr), count, out));
+		default:
+			throw std::runtime_error("Unsupported segmentation data type '"
+					+ std::to_string(segmentation->GetDataType()) + "'");
+	}
+}
+
+template<typename T>
+static void histogram_kernel(const T *data, vtkDataArray *segmentation, const size_t num_voxels,
+		const float value_min, const float value_max, SegmentHistograms &out)
+{
+	const size_t num_bins = out.num_bins;
+	const size_t hist_size = out.num_segments * num_bins;
+	const float range = value_max - value_min;
+	const float bin_scale = range > 0.f ? num_bins / range : 0.f;
+	const int32_t max_bin = static_cast<int32_t>(num_bins) - 1;
+	const int64_t num_segments = static_cast<int64_t>(out.num_segments);
+
+	const size_t num_threads = get_num_threads();
+	const bool use_private = num_threads * hist_size * sizeof(uint32_t) <= MAX_PRIVATE_BIN_BYTES;
+	// Private bins are 32-bit and are flushed to the 64-bit totals before they could overflow
+	std::vector<std::vector<uint32_t>> private_bins(use_private ? num_threads : 0);
+	std::vector<std::vector<size_t>> private_totals(use_private ? num_threads : 0);
+	std::vector<size_t> private_counts(num_threads, 0);
+	std::vector<std::atomic<uint64_t>> shared_bins(use_private ? 0 : hist_size);
+	for (auto &b : shared_bins) {
+		b = 0;
+	}
+	auto flush_private = [&](const size_t thread_id) {
+		std::vector<size_t> &totals = private_totals[thread_id];
+		std::vector<uint32_t> &bins = private_bins[thread_id];
+		if (totals.empty()) {
+			totals.resize(hist_size, 0);
+		}
+		for (size_t b = 0; b < bins.size(); ++b) {
+			totals[b] += bins[b];
+		}
+		std::fill(bins.begin(), bins.end(), 0);
+		private_counts[thread_id] = 0;
+	};
+
+	parallel_for(0, num_voxels, TASK_SIZE, [&](const size_t begin, const size_t end, const size_t thread_id) {
+		std::array<int32_t, BATCH_SIZE> bin_idx;
+		std::array<int64_t, BATCH_SIZE> seg_idx;
+		uint32_t *bins = nullptr;
+		if (use_private) {
+			if (private_counts[thread_id] + (end - begin) > std::numeric_limits<uint32_t>::max()) {
+				flush_private(thread_id);
+			}
+			if (private_bins[thread_id].empty()) {
+				private_bins[thread_id].resize(hist_size, 0);
+			}
+			bins = private_bins[thread_id].data();
+			private_counts[thread_id] += end - begin;
+		}
+		for (size_t i = begin; i < end; i += BATCH_SIZE) {
+			const size_t count = std::min(BATCH_SIZE, end - i);
+			compute_bins(data + i, count, value_min, bin_scale, max_bin, bin_idx.data());
+			read_segments(segmentation, i, count, seg_idx.data());
+			for (size_t j = 0; j < count; ++j) {
+				if (seg_idx[j] < 0 || seg_idx[j] >= num_segments) {
+					continue;
+				}
+				const size_t b = seg_idx[j] * num_bins + bin_idx[j];
+				if (bins) {
+					++bins[b];
+				} else {
+					shared_bins[b].fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		}
+	});
+
+	out.bins.clear();
+	out.bins.resize(hist_size, 0);
+	if (use_private) {
+		// Merge the per thread bins in parallel over the bins
+		parallel_for(0, hist_size, 1 << 16, [&](const size_t begin, const size_t end, const size_t) {
+			for (size_t t = 0; t < num_threads; ++t) {
+				if (!private_bins[t].empty()) {
+					for (size_t b = begin; b < end; ++b) {
+						out.bins[b] += private_bins[t][b];
+					}
+				}
+				if (!private_totals[t].empty()) {
+					for (size_t b = begin; b < end; ++b) {
+						out.bins[b] += private_totals[t][b];
+					}
+				}
+			}
+		});
+	} else {
+		for (size_t b = 0; b < hist_size; ++b) {
+			out.bins[b] = shared_bins[b];
+		}
+	}
+}
+
+SegmentHistograms::SegmentHistograms() : num_bins(0), num_segments(0), value_min(0), value_max(0) {}
+void SegmentHistograms::sum_selected(const std::vector<unsigned int> &selections,
+		std::vector<size_t> &histogram) const
+{
+	histogram.clear();
+	histogram.resize(num_bins, 0);
+	const bool sum_all = selections.size() != num_segments;
+	for (size_t s = 0; s < num_segments; ++s) {
+		if (sum_all || selections[s] != 0) {
+			const size_t *seg_bins = bins.data() + s * num_bins;
+			for (size_t b = 0; b < num_bins; ++b) {
+				histogram[b] += seg_bins[b];
+			}
+		}
+	}
+}
+
+void build_segment_histograms(vtkDataArray *data, vtkDataArray *segmentation,
+		const float value_min, const float value_max, const size_t num_bins, SegmentHistograms &out)
+{
+	out.num_bins = num_bins;
+	out.num_segments = segmentation ? static_cast<size_t>(segmentation->GetRange()[1]) + 1 : 1;
+	out.value_min = value_min;
+	out.value_max = value_max;
+
+	const size_t num_voxels = data->GetNumberOfTuples();
+	void *ptr = data->GetVoidPointer(0);
+	switch (data->GetDataType()) {
+		vtkTemplateMacro(histogram_kernel(static_cast<const VTK_TT*>(ptr), segmentation, num_voxels,
+					value_min, value_max, out));
+		default:
+			throw std::runtime_error("Unsupported volume data type '"
+					+ std::to_string(data->GetDataType()) + "'");
+	}
+}
+
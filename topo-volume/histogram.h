@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <vtkDataArray.h>
+
+/* Histograms of the volume's values for each segment of the segmentation,
+ * the bins for segment s are at [s * num_bins, (s + 1) * num_bins). The
+ * histogram for any selection of segments is the sum of their bins, so it
+ * can be computed without going back over the volume.
+ */
+struct SegmentHistograms {
+	size_t num_bins, num_segments;
+	// The value range the bins cover
+	float value_min, value_max;
+	std::vector<size_t> bins;
+
+	SegmentHistograms();
+	/* Sum the bins of the segments marked non-zero in the selection to build the
+	 * histogram of the selection. If the selection doesn't match the number of
+	 * segments all segments are summed
+	 */
+	void sum_selected(const std::vector<unsigned int> &selections, std::vector<size_t> &histogram) const;
+};
+
+/* Build the histogram of each segment of the data in one parallel pass over the
+ * volume, with bins covering [value_min, value_max]. The segment ids are read from
+ * the segmentation array, which may be null to build a single histogram of the
+ * whole volume. Supports all of VTK's scalar types for the data.
+ */
+void build_segment_histograms(vtkDataArray *data, vtkDataArray *segmentation,
+		const float value_min, const float value_max, const size_t num_bins, SegmentHistograms &out);
+/* Read count segment ids starting at begin from the segmentation array as int64, so
+ * callers don't depend on the id type. If the segmentation is null all ids are 0.
+ */
+void read_segments(vtkDataArray *segmentation, const size_t begin, const size_t count, int64_t *out);
+
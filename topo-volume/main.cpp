@@ -1,8 +1,10 @@
 #include <thread>
-#include <regex>
+#include <chrono>
+#include <memory>
 #include <vector>
 #include <string>
 #include <cassert>
+#include <algorithm>
 
 #define SDL_MAIN_HANDLED
 #include <SDL.h>
@@ -11,8 +13,6 @@
 #include <glm/ext.hpp>
 
 #include <vtkSmartPointer.h>
-#include <vtkXMLImageDataReader.h>
-#include <vtkImageReader2.h>
 #include <vtkImageData.h>
 #include <vtkThreshold.h>
 
@@ -33,26 +33,99 @@
 #include "volume.h"
 #include "tree_widget.h"
 #include "persistence_curve_widget.h"
+#include "volume_io.h"
+#include "render_target.h"
+#include "quality_controller.h"
+#include "cpu_renderer.h"
+#include "topology_cache.h"
+#include "async_loader.h"
+#include "pipeline_profiler.h"
+#include "profiler_widget.h"
+#include "frame_timeline.h"
 
 static size_t WIN_WIDTH = 1280;
 static size_t WIN_HEIGHT = 720;
 static unsigned int debuglevel = 0;
-
-void run_app(SDL_Window *win, const std::vector<std::string> &args);
+// How to read the volume files, e.g. the byte order and reader used for RAW files
+static VolumeLoadOptions load_options;
+// Directory to cache the computed topology in, the cache is disabled if empty
+static std::string topology_cache_dir;
+// GPU memory budget for the volume textures, larger volumes are bricked
+static size_t gpu_memory_budget = size_t(2048) * 1024 * 1024;
+// Bytes of the volume textures to upload each frame
+static size_t upload_budget = size_t(64) * 1024 * 1024;
+// Target time for the volume pass while the camera is moving
+static float frame_target_ms = 16.f;
+// Number of jittered frames averaged when progressive refinement is on
+static int max_accumulated_frames = 16;
+// Step multiplier for each frame averaged, since the frames together sample the volume finely
+static const float PROGRESSIVE_STEP_SCALE = 2.f;
+// Classify with the pre-integrated palettes, which hold up with twice the sampling step
+static bool preintegrated = false;
+static const float PREINTEGRATED_STEP_SCALE = 2.f;
+// Frames to keep drawing after input before going idle, ImGui takes a few frames to settle
+static const int UI_SETTLE_FRAMES = 3;
+// Records the topology pipeline's stages for each volume loaded. It's reference counted
+// by the filters it watches, and kept alive here for the profiler panel
+static vtkSmartPointer<PipelineProfiler> profiler = vtkSmartPointer<PipelineProfiler>::New();
+
+void run_app(SDL_Window *win, std::unique_ptr<AsyncLoader> &loader);
 void setup_window(SDL_Window *&win, SDL_GLContext &ctx);
 void default_commands(int argc, const char **argv) {
 	for (int i = 1; i < argc; ++i) {
+		if (parse_raw_option(argc, argv, i, load_options)) {
+			continue;
+		}
 		std::string str(argv[i]);
 		if (str == "-debug") {
 			debuglevel = std::stoi(argv[++i]);
+			load_options.debuglevel = debuglevel;
+		} else if (str == "-cache") {
+			topology_cache_dir = argv[++i];
+		} else if (str == "-gpu-budget") {
+			// Budget for the volume textures in MB
+			gpu_memory_budget = std::stoull(argv[++i]) * 1024 * 1024;
+		} else if (str == "-upload-budget") {
+			// Upload budget per frame in MB
+			upload_budget = std::stoull(argv[++i]) * 1024 * 1024;
+		} else if (str == "-frame-target") {
+			// Target volume render time in ms while interacting
+			frame_target_ms = std::stof(argv[++i]);
+		} else if (str == "-preintegrated") {
+			preintegrated = true;
+		} else if (str == "-accumulate") {
+			// Number of frames to average when idle
+			max_accumulated_frames = std::max(1, std::stoi(argv[++i]));
 		}
 	}
 }
-// Load a VTI file or RAW volume. RAW volume files must follow
-// the naming convention used in the Open SciVis Datasets collection
-// https://github.com/pavolzetor/open_scivis_datasets where
-// the file name is <name>_<X>x<Y>x<Z>_<data type>.raw
-vtkSmartPointer<vtkImageData> load_volume(const std::string &file);
+std::unique_ptr<AsyncLoader> start_loading(const std::string &file) {
+	auto load_fn = [](const std::string &f, const std::atomic<bool> *cancel) {
+		return load_volume(f, load_options, cancel);
+	};
+	return std::make_unique<AsyncLoader>(file, load_fn, topology_cache_dir, debuglevel, profiler.Get());
+}
+// Render the volume as currently shown with the CPU renderer and save it to the file
+void save_cpu_render(const Volume &volume, const TransferFunction &tfcn, const glm::mat4 &proj,
+		const glm::mat4 &view, const std::string &file)
+{
+	using namespace std::chrono;
+	const auto start = high_resolution_clock::now();
+	CpuRenderer renderer(volume.get_data_array(), volume.get_segmentation_array(), volume.get_dims());
+	renderer.set_classification(tfcn.get_palette_table(), volume.segmentation_selections,
+			volume.segmentation_palettes);
+	RenderView render_view;
+	render_view.proj = proj;
+	render_view.view = view;
+	render_view.vol_transform = volume.get_transform();
+	render_view.width = WIN_WIDTH;
+	render_view.height = WIN_HEIGHT;
+	render_view.frames = max_accumulated_frames;
+	write_ppm(file, renderer.render(render_view));
+	const auto end = high_resolution_clock::now();
+	std::cout << "CPU render saved to " << file << " in "
+		<< duration_cast<milliseconds>(end - start).count() << "ms\n";
+}
 
 int main(int argc, const char **argv) {
 	if (argc < 2) {
@@ -60,30 +133,30 @@ int main(int argc, const char **argv) {
 		return 1;
 	}
 	default_commands(argc, argv);
+	// Start loading right away so the I/O overlaps with creating the window and GL context
+	std::unique_ptr<AsyncLoader> loader = start_loading(argv[1]);
 	SDL_Window *win = nullptr;
 	SDL_GLContext ctx = nullptr;
 	setup_window(win, ctx);
-	run_app(win, std::vector<std::string>(argv, argv + argc));
+	run_app(win, loader);
 	ImGui_ImplSdlGL3_Shutdown();
 	SDL_GL_DeleteContext(ctx);
 	SDL_DestroyWindow(win);
 	SDL_Quit();
 	return 0;
 }
-void run_app(SDL_Window *win, const std::vector<std::string> &args) {
-	vtkSmartPointer<vtkImageData> vol = load_volume(args[1]);
-
-	glm::vec3 vol_render_size;
-	for (size_t i = 0; i < 3; ++i) {
-		vol_render_size[i] = vol->GetSpacing()[i] * vol->GetDimensions()[i];
-	}
+void run_app(SDL_Window *win, std::unique_ptr<AsyncLoader> &loader) {
 	std::shared_ptr<glt::BufferAllocator> allocator = std::make_shared<glt::BufferAllocator>(size_t(64e6));
 
 	glm::mat4 proj_mat = glm::perspective(glm::radians(65.f),
 			static_cast<float>(WIN_WIDTH) / WIN_HEIGHT, 0.1f, 2000.f);
-	glt::ArcBallCamera camera(glm::lookAt(glm::vec3{0.0, 0.0, vol_render_size.z},
-			glm::vec3{0.0, 0.0, 0}, glm::vec3{0, 1, 0}),
-			2.0, 75.0, {WIN_WIDTH, WIN_HEIGHT});
+	// The camera is placed based on the volume's size once it's loaded
+	auto make_camera = [](const glm::vec3 &vol_render_size) {
+		return glt::ArcBallCamera(glm::lookAt(glm::vec3{0.0, 0.0, vol_render_size.z},
+					glm::vec3{0.0, 0.0, 0}, glm::vec3{0, 1, 0}),
+				2.0, 75.0, {WIN_WIDTH, WIN_HEIGHT});
+	};
+	glt::ArcBallCamera camera = make_camera(glm::vec3(1));
 
 	// Note the vec3 is padded to a vec4 size, so we need a bit more room
 	auto viewing_buf = allocator->alloc(2 * sizeof(glm::mat4) + sizeof(glm::vec4), glt::BufAlignment::UNIFORM_BUFFER);
@@ -103,40 +176,85 @@ void run_app(SDL_Window *win, const std::vector<std::string> &args) {
 		viewing_buf.unmap(GL_UNIFORM_BUFFER);
 	}
 
-	PersistenceCurveWidget persistence_curve_widget(vol.Get(), debuglevel);
-
-	vtkSmartPointer<ttkFTMTree> contour_forest
-		= vtkSmartPointer<ttkFTMTree>::New();
-	contour_forest->SetInputConnection(persistence_curve_widget.get_simplification()->GetOutputPort());
-	contour_forest->SetSuperArcSamplingLevel(10);
-	contour_forest->SetUseAllCores(true);
-	contour_forest->SetThreadNumber(std::thread::hardware_concurrency());
-	contour_forest->SetdebugLevel_(debuglevel);
-	contour_forest->SetWithSegmentation(true);
-	// Setup transfer function and volume
+	// The volume is rendered offscreen, at a lower resolution while interacting
+	// if needed to hit the frame time target, and composited into the window
+	RenderTarget volume_target;
+	QualityController quality(frame_target_ms);
+	// While nothing changes the volume is rendered with a new jitter each frame and
+	// averaged into the accumulation target to progressively refine it
+	RenderTarget accum_target;
+	bool progressive = true;
+	int accumulated_frames = 0;
+
+	// Time the parts of each frame on the CPU and GPU to find what's causing stutter
+	FrameTimeline timeline;
+	const size_t events_zone = timeline.add_zone("events");
+	const size_t loader_zone = timeline.add_zone("loader");
+	const size_t tfcn_render_zone = timeline.add_zone("tfcn.render");
+	const size_t volume_render_zone = timeline.add_zone("volume.render");
+	const size_t topovol_ui_zone = timeline.add_zone("topovol.draw_ui");
+	const size_t loader_ui_zone = timeline.add_zone("loader.draw_ui");
+	const size_t tfcn_ui_zone = timeline.add_zone("tfcn.draw_ui");
+	const size_t profiler_ui_zone = timeline.add_zone("profiler.draw_ui");
+	const size_t tree_ui_zone = timeline.add_zone("tree.draw_ui");
+	const size_t persistence_ui_zone = timeline.add_zone("persistence.draw_ui");
+	const size_t timeline_ui_zone = timeline.add_zone("timeline.draw_ui");
+	const size_t imgui_render_zone = timeline.add_zone("ImGui::Render");
+	const size_t swap_zone = timeline.add_zone("swap");
+
+	// Setup transfer function, the volume and topology are handed over by the loader
+	// as they become ready. The topology outlives the volume which watches its segmentation
 	TransferFunction tfcn;
-	contour_forest->AddObserver(vtkCommand::EndEvent, &tfcn);
-
-	TreeWidget tree_widget(contour_forest, persistence_curve_widget.get_simplification());
-	Volume volume(vol.Get(), vtkImageData::SafeDownCast(contour_forest->GetOutput(2)));
-	tfcn.histogram = &volume.histogram;
-
-	std::vector<unsigned int> prev_seg_selection, prev_seg_palettes;
+	std::unique_ptr<TopologyCache> topology_cache;
+	std::unique_ptr<PersistenceCurveWidget> persistence_curve_widget;
+	vtkSmartPointer<ttkFTMTree> contour_forest;
+	std::unique_ptr<TreeWidget> tree_widget;
+	std::unique_ptr<Volume> volume;
+	ProfilerWidget profiler_widget(profiler.Get());
+
+	// The tree selection last sent to the volume, the palette assignments are pushed
+	// to the volume by the transfer function when they change
+	uint64_t prev_selection_version = 0;
+	tfcn.assignment_changed = [&](const std::vector<unsigned int> &seg_palettes) {
+		if (volume) {
+			volume->segmentation_palettes = seg_palettes;
+			volume->segmentation_selection_changed = true;
+		}
+	};
 	bool ui_hovered = false;
 	bool quit = false;
 	bool camera_updated = false;
 	int volume_render_mode = 0;
+	// Frames left to draw before going idle, reset on input or pending work. When it runs
+	// out there's nothing left to draw so we sleep until there's input instead of redrawing
+	// the same frame
+	int active_frames = UI_SETTLE_FRAMES;
+	// The time of the last frame drawn, excluding any time spent idle
+	float frame_ms = 16.f;
 	while (!quit) {
+		if (active_frames <= 0) {
+			// Wake up periodically while loading to pick up the loader's results and progress
+			if (loader) {
+				SDL_WaitEventTimeout(nullptr, 100);
+			} else {
+				SDL_WaitEvent(nullptr);
+			}
+			active_frames = 1;
+		}
+		const uint32_t frame_start = SDL_GetTicks();
+		timeline.begin_frame();
+		timeline.begin_zone(events_zone);
 		SDL_Event e;
 		while (SDL_PollEvent(&e)){
 			ImGui_ImplSdlGL3_ProcessEvent(&e);
+			active_frames = UI_SETTLE_FRAMES;
 
 			if (e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE)){
 				quit = true;
 				break;
 			}
 			if (!ui_hovered) {
-				camera_updated |= camera.sdl_input(e, 1000.f / ImGui::GetIO().Framerate);
+				camera_updated |= camera.sdl_input(e, frame_ms);
 			}
 			if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
 				WIN_WIDTH = e.window.data1;
@@ -145,7 +263,38 @@ void run_app(SDL_Window *win, const std::vector<std::string> &args) {
 				camera_updated = true;
 			}
 		}
+		timeline.end_zone(events_zone);
+
+		// Pick up the loader's results as they become ready
+		if (loader) {
+			FrameTimeline::Zone zone(timeline, loader_zone);
+			if (!volume && loader->volume_ready()) {
+				volume = loader->take_volume();
+				volume->set_gpu_memory_budget(gpu_memory_budget);
+				volume->set_upload_budget(upload_budget);
+				const glm::vec2 value_range = volume->get_value_range();
+				volume->set_isovalue(0.5f * (value_range.x + value_range.y));
+				volume->toggle_isosurface(volume_render_mode == 1);
+				volume->set_palette_alpha(tfcn.get_palette_alpha(), TransferFunction::PALETTE_SAMPLES);
+				tfcn.histogram = &volume->histogram;
+				camera = make_camera(loader->get_render_size());
+				camera_updated = true;
+			}
+			if (volume && loader->topology_ready()) {
+				loader->take_topology(topology_cache, persistence_curve_widget, contour_forest, tree_widget);
+				contour_forest->AddObserver(vtkCommand::EndEvent, &tfcn);
+				tfcn.Execute(contour_forest, vtkCommand::EndEvent, nullptr);
+				volume->set_segmentation(vtkImageData::SafeDownCast(contour_forest->GetOutput(2)));
+				tree_widget->segment_stats = &volume->segment_stats;
+				// Force the tree selection to be sent to the volume
+				prev_selection_version = tree_widget->get_selection_version() - 1;
+				loader = nullptr;
+			}
+		}
+
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		const bool camera_moved = camera_updated;
+		quality.update(camera_moved);
 		if (camera_updated) {
 			char *buf = static_cast<char*>(viewing_buf.map(GL_UNIFORM_BUFFER, GL_MAP_WRITE_BIT));
 			glm::mat4 *mats = reinterpret_cast<glm::mat4*>(buf);
@@ -158,43 +307,167 @@ void run_app(SDL_Window *win, const std::vector<std::string> &args) {
 		}
 
 		glViewport(0, 0, WIN_WIDTH, WIN_HEIGHT);
-		tfcn.render();
-		volume.render(allocator);
+		timeline.begin_zone(tfcn_render_zone);
+		const bool fcn_changed = tfcn.render();
+		timeline.end_zone(tfcn_render_zone);
+		if (volume) {
+			FrameTimeline::Zone zone(timeline, volume_render_zone);
+			if (fcn_changed) {
+				volume->set_palette_alpha(tfcn.get_palette_alpha(), TransferFunction::PALETTE_SAMPLES);
+			}
+			volume->set_preintegrated(preintegrated);
+			volume->set_step_scale(quality.step_scale() * (progressive ? PROGRESSIVE_STEP_SCALE : 1.f)
+					* (preintegrated ? PREINTEGRATED_STEP_SCALE : 1.f));
+			const float res_scale = quality.resolution_scale();
+			const int target_width = std::max(1, static_cast<int>(WIN_WIDTH * res_scale));
+			const int target_height = std::max(1, static_cast<int>(WIN_HEIGHT * res_scale));
+			// The volume pass is cached in the accumulation target, and only re-rendered
+			// if anything changed the image or we're still refining it
+			if (camera_moved || fcn_changed || quality.is_interacting() || volume->needs_redraw()
+					|| target_width != accum_target.get_width() || target_height != accum_target.get_height())
+			{
+				accumulated_frames = 0;
+			}
+			if (accumulated_frames < (progressive ? max_accumulated_frames : 1)) {
+				volume_target.resize(target_width, target_height);
+				volume_target.bind();
+				volume_target.clear();
+				volume->set_frame_seed(accumulated_frames);
+				quality.begin_pass();
+				volume->render(allocator);
+				quality.end_pass();
+
+				accum_target.resize(target_width, target_height);
+				accum_target.blend(volume_target, 1.f / (accumulated_frames + 1));
+				++accumulated_frames;
+			}
+
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glViewport(0, 0, WIN_WIDTH, WIN_HEIGHT);
+			accum_target.composite();
+		}
 
 		// Draw UI
 		ImGui_ImplSdlGL3_NewFrame(win);
 		glViewport(0, 0, (int)ImGui::GetIO().DisplaySize.x, (int)ImGui::GetIO().DisplaySize.y);
 
+		timeline.begin_zone(topovol_ui_zone);
 		if (ImGui::Begin("TopoVol")) {
 			ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
 					1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+			ImGui::Checkbox("Adaptive Quality", &quality.enabled);
+			if (ImGui::Checkbox("Progressive Refinement", &progressive)) {
+				accumulated_frames = 0;
+			}
+			ImGui::Checkbox("Pre-integrated Transfer Function", &preintegrated);
+			if (progressive) {
+				ImGui::SameLine();
+				ImGui::Text("%d/%d frames", accumulated_frames, max_accumulated_frames);
+			}
+			float target_ms = quality.get_target_ms();
+			if (ImGui::SliderFloat("Target ms", &target_ms, 4.f, 100.f)) {
+				quality.set_target_ms(target_ms);
+			}
+			ImGui::Text("Volume pass %.2f ms, step x%.2f, resolution %.0f%%", quality.last_pass_ms(),
+					quality.step_scale(), quality.resolution_scale() * 100.f);
+			if (volume && ImGui::Button("Save CPU Render")) {
+				save_cpu_render(*volume, tfcn, proj_mat, camera.transform(), "cpu_render.ppm");
+			}
+			if (volume) {
+				bool mode_changed = ImGui::RadioButton("Volume", &volume_render_mode, 0);
+				ImGui::SameLine();
+				mode_changed |= ImGui::RadioButton("Isosurface", &volume_render_mode, 1);
+				if (mode_changed) {
+					volume->toggle_isosurface(volume_render_mode == 1);
+				}
+				if (volume_render_mode == 1) {
+					float isovalue = volume->get_isovalue();
+					const glm::vec2 value_range = volume->get_value_range();
+					if (ImGui::SliderFloat("Isovalue", &isovalue, value_range.x, value_range.y)) {
+						volume->set_isovalue(isovalue);
+					}
+				}
+			}
+			if (volume && volume->uploading()) {
+				ImGui::Text("Loading volume to the GPU");
+				ImGui::ProgressBar(volume->upload_progress());
+			}
 		}
 		ImGui::End();
+		timeline.end_zone(topovol_ui_zone);
+
+		if (loader) {
+			FrameTimeline::Zone zone(timeline, loader_ui_zone);
+			std::string new_file;
+			if (loader->draw_ui(new_file)) {
+				// Drop the previous data, the volume first since it watches the segmentation
+				volume = nullptr;
+				tree_widget = nullptr;
+				contour_forest = nullptr;
+				persistence_curve_widget = nullptr;
+				topology_cache = nullptr;
+				tfcn.histogram = nullptr;
+				loader = start_loading(new_file);
+			}
+		}
+
+		{
+			FrameTimeline::Zone zone(timeline, tfcn_ui_zone);
+			tfcn.draw_ui();
+		}
+		{
+			FrameTimeline::Zone zone(timeline, profiler_ui_zone);
+			profiler_widget.draw_ui();
+		}
+		{
+			FrameTimeline::Zone zone(timeline, timeline_ui_zone);
+			timeline.draw_ui();
+		}
+		if (tree_widget) {
+			{
+				FrameTimeline::Zone zone(timeline, tree_ui_zone);
+				tree_widget->draw_ui();
+			}
+			persistence_curve_widget->set_tree_type(tree_widget->get_tree_type());
+			{
+				FrameTimeline::Zone zone(timeline, persistence_ui_zone);
+				persistence_curve_widget->draw_ui();
+			}
 
-		tfcn.draw_ui();
-		tree_widget.draw_ui();
-		persistence_curve_widget.set_tree_type(tree_widget.get_tree_type());
-		persistence_curve_widget.draw_ui();
-
-		const auto &tree_selection = tree_widget.get_selection();
-		const auto &seg_palettes = tfcn.get_segmentation_palettes();
-		if (prev_seg_selection != tree_selection || seg_palettes != prev_seg_palettes) {
-			std::fill(volume.segmentation_selections.begin(), volume.segmentation_selections.end(),
-					tree_selection.empty() ? 1 : 0);
-			for (const auto &x : tree_selection) {
-				volume.segmentation_selections[x] = 1;
+			if (tree_widget->get_selection_version() != prev_selection_version) {
+				const auto &tree_selection = tree_widget->get_selection();
+				std::fill(volume->segmentation_selections.begin(), volume->segmentation_selections.end(),
+						tree_selection.empty() ? 1 : 0);
+				for (const auto &x : tree_selection) {
+					volume->segmentation_selections[x] = 1;
+				}
+				volume->segmentation_selection_changed = true;
+				prev_selection_version = tree_widget->get_selection_version();
 			}
-			volume.segmentation_palettes = seg_palettes;
-			volume.segmentation_selection_changed = true;
-			prev_seg_selection = tree_selection;
-			prev_seg_palettes = seg_palettes;
 		}
 
 		ui_hovered = ImGui::IsMouseHoveringAnyWindow();
+		timeline.begin_zone(imgui_render_zone);
 		ImGui::Render();
+		timeline.end_zone(imgui_render_zone);
 
+		timeline.begin_zone(swap_zone);
 		SDL_GL_SwapWindow(win);
+		timeline.end_zone(swap_zone);
+
+		// Keep drawing while the volume is refining, uploading or changing, or the camera is moving
+		const bool pending_work = quality.is_interacting() || (volume && (volume->needs_redraw()
+					|| accumulated_frames < (progressive ? max_accumulated_frames : 1)));
+		if (pending_work) {
+			active_frames = UI_SETTLE_FRAMES;
+		} else {
+			--active_frames;
+		}
+		frame_ms = std::max(1.f, static_cast<float>(SDL_GetTicks() - frame_start));
+		timeline.end_frame();
 	}
+	// Stop the loader before tearing down the GL state it may hand objects over to
+	loader = nullptr;
 }
 void setup_window(SDL_Window *&win, SDL_GLContext &ctx) {
 	if (SDL_Init(SDL_INIT_EVERYTHING) != 0){
@@ -247,57 +520,3 @@ void setup_window(SDL_Window *&win, SDL_GLContext &ctx) {
 	glClearColor(0.1, 0.1, 0.1, 1);
 	glClearDepth(1.0);
 }
-vtkSmartPointer<vtkImageData> load_volume(const std::string &file) {
-	vtkSmartPointer<vtkImageData> vol = nullptr;
-	const std::string file_ext = file.substr(file.size() - 3);
-	if (file_ext == "vti") {
-		vtkSmartPointer<vtkXMLImageDataReader> reader
-			= vtkSmartPointer<vtkXMLImageDataReader>::New();
-		reader->SetFileName(file.c_str());
-		reader->Update();
-		vol = reader->GetOutput();
-	} else if (file_ext == "raw") {
-		std::cout << "Note: raw files do not have voxel spacing information, if your "
-			<< "file does not have square voxels it may appear incorrectly scaled\n";
-
-		const std::regex match_filename("(\\w+)_(\\d+)x(\\d+)x(\\d+)_(.+)\\.raw");
-		auto matches = std::sregex_iterator(file.begin(), file.end(), match_filename);
-		if (matches == std::sregex_iterator() || matches->size() != 6) {
-			std::cerr << "Unrecognized raw volume naming scheme, expected a format like: "
-				<< "'<name>_<X>x<Y>x<Z>_<data type>.raw' but '" << file << "' did not match"
-				<< std::endl;
-			throw std::runtime_error("Invalaid raw file naming scheme");
-		}
-
-		std::array<int, 3> dims = {std::stoi((*matches)[2]), std::stoi((*matches)[3]), std::stoi((*matches)[4])};
-		std::string data_type = (*matches)[5];
-		int vtk_data_type = -1;
-		if (data_type == "uint8") {
-			vtk_data_type = VTK_UNSIGNED_CHAR;
-		} else if (data_type == "int8") {
-			vtk_data_type = VTK_CHAR;
-		} else if (data_type == "uint16") {
-			vtk_data_type = VTK_UNSIGNED_SHORT;
-		} else if (data_type == "int16") {
-			vtk_data_type = VTK_SHORT;
-		} else if (data_type == "float32") {
-			vtk_data_type = VTK_FLOAT;
-		} else {
-			throw std::runtime_error("Unsupported or unrecognized data type: " + data_type);
-		}
-
-		vtkSmartPointer<vtkImageReader2> reader = vtkSmartPointer<vtkImageReader2>::New();
-		reader->SetFileName(file.c_str());
-		reader->SetFileDimensionality(3);
-		reader->SetDataExtent(0, dims[0] - 1, 0, dims[1] - 1, 0, dims[2] - 1);
-		reader->SetDataScalarType(vtk_data_type);
-		reader->Update();
-		vol = reader->GetOutput();
-	}
-	if (vol.Get() == nullptr) {
-		throw std::runtime_error("Failed to load volume file " + file);
-	}
-	return vol;
-}
-
-
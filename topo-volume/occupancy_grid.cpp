@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vtkType.h>
+#include "parallel.h"
+#include "histogram.h"
+#include "occupancy_grid.h"
+
+template<typename T>
+static void grid_kernel(const T *data, vtkDataArray *segmentation, const std::array<int, 3> &dims,
+		OccupancyGrid &out)
+{
+	const std::array<int, 3> &grid_dims = out.grid_dims;
+	const size_t num_cells = out.num_cells();
+	std::vector<std::vector<uint32_t>> cell_segments(num_cells);
+
+	parallel_for(0, num_cells, 16, [&](const size_t begin, const size_t end, const size_t) {
+		std::vector<int64_t> row_segments(OccupancyGrid::CELL_SIZE + 2);
+		for (size_t c = begin; c < end; ++c) {
+			const std::array<int, 3> cell = {
+				static_cast<int>(c % grid_dims[0]),
+				static_cast<int>((c / grid_dims[0]) % grid_dims[1]),
+				static_cast<int>(c / (grid_dims[0] * grid_dims[1]))
+			};
+			// Include a one voxel border so we cover the voxels interpolated between by samples in the cell
+			std::array<int, 3> lo, hi;
+			for (size_t i = 0; i < 3; ++i) {
+				lo[i] = std::max(cell[i] * OccupancyGrid::CELL_SIZE - 1, 0);
+				hi[i] = std::min((cell[i] + 1) * OccupancyGrid::CELL_SIZE + 1, dims[i]);
+			}
+			float vmin = std::numeric_limits<float>::max();
+			float vmax = std::numeric_limits<float>::lowest();
+			std::vector<uint32_t> &segs = cell_segments[c];
+			const size_t row_len = hi[0] - lo[0];
+			for (int z = lo[2]; z < hi[2]; ++z) {
+				for (int y = lo[1]; y < hi[1]; ++y) {
+					const size_t row = (static_cast<size_t>(z) * dims[1] + y) * dims[0] + lo[0];
+					const T *vals = data + row;
+					for (size_t x = 0; x < row_len; ++x) {
+						const float v = static_cast<float>(vals[x]);
+						vmin = std::min(vmin, v);
+						vmax = std::max(vmax, v);
+					}
+					read_segments(segmentation, row, row_len, row_segments.data());
+					for (size_t x = 0; x < row_len; ++x) {
+						// Segments tend to be coherent, so skip runs of the same one
+						if (row_segments[x] >= 0 && (segs.empty() || segs.back() != row_segments[x])) {
+							segs.push_back(static_cast<uint32_t>(row_segments[x]));
+						}
+					}
+				}
+			}
+			std::sort(segs.begin(), segs.end());
+			segs.erase(std::unique(segs.begin(), segs.end()), segs.end());
+			out.cell_min[c] = vmin;
+			out.cell_max[c] = vmax;
+		}
+	});
+
+	out.segment_offsets.resize(num_cells + 1);
+	out.segment_offsets[0] = 0;
+	for (size_t c = 0; c < num_cells; ++c) {
+		out.segment_offsets[c + 1] = out.segment_offsets[c] + cell_segments[c].size();
+	}
+	out.segments.resize(out.segment_offsets.back());
+	parallel_for(0, num_cells, 256, [&](const size_t begin, const size_t end, const size_t) {
+		for (size_t c = begin; c < end; ++c) {
+			std::copy(cell_segments[c].begin(), cell_segments[c].end(),
+					out.segments.begin() + out.segment_offsets[c]);
+		}
+	});
+}
+
+OccupancyGrid::OccupancyGrid() : grid_dims({0, 0, 0}) {}
+size_t OccupancyGrid::num_cells() const {
+	return static_cast<size_t>(grid_dims[0]) * grid_dims[1] * grid_dims[2];
+}
+bool OccupancyGrid::update_occupied(const std::vector<unsigned int> &selections,
+		const std::vector<unsigned int> &palettes, const PaletteCoverage &coverage)
+{
+	std::vector<uint8_t> new_occupied(num_cells(), 0);
+	parallel_for(0, num_cells(), 256, [&](const size_t begin, const size_t end, const size_t) {
+		for (size_t c = begin; c < end; ++c) {
+			for (uint32_t i = segment_offsets[c]; i < segment_offsets[c + 1]; ++i) {
+				const uint32_t s = segments[i];
+				const bool selected = s >= selections.size() || selections[s] != 0;
+				if (!selected) {
+					continue;
+				}
+				const size_t p = s < palettes.size() ? palettes[s] : 0;
+				if (coverage.visible(p, cell_min[c], cell_max[c])) {
+					new_occupied[c] = 1;
+					break;
+				}
+			}
+		}
+	});
+	const bool changed = new_occupied != occupied;
+	occupied = std::move(new_occupied);
+	return changed;
+}
+
+void build_occupancy_grid(vtkDataArray *data, vtkDataArray *segmentation,
+		const std::array<int, 3> &dims, OccupancyGrid &out)
+{
+	for (size_t i = 0; i < 3; ++i) {
+		out.grid_dims[i] = (dims[i] + OccupancyGrid::CELL_SIZE - 1) / OccupancyGrid::CELL_SIZE;
+	}
+	const size_t num_cells = out.num_cells();
+	out.cell_min.resize(num_cells);
+	out.cell_max.resize(num_cells);
+	out.occupied.clear();
+	out.occupied.resize(num_cells, 1);
+
+	void *ptr = data->GetVoidPointer(0);
+	switch (data->GetDataType()) {
+		vtkTemplateMacro(grid_kernel(static_cast<const VTK_TT*>(ptr), segmentation, dims, out));
+		default:
+			throw std::runtime_error("Unsupported volume data type '"
+					+ std::to_string(data->GetDataType()) + "'");
+	}
+}
+
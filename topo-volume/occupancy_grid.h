@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <vtkDataArray.h>
+#include "palette_coverage.h"
+
+/* A coarse grid of macrocells over the volume used to skip empty space when
+ * ray marching. Each cell stores the range of values and the set of segments
+ * in its voxels, including a one voxel border for the interpolation done when
+ * sampling the volume. Which cells are occupied depends on the segment selection
+ * and palettes, and is recomputed from these without going back over the volume.
+ */
+struct OccupancyGrid {
+	// Size of each macrocell in voxels along each axis
+	static const int CELL_SIZE = 16;
+
+	std::array<int, 3> grid_dims;
+	// The range of values in each cell
+	std::vector<float> cell_min, cell_max;
+	// The segments in cell i are segments[segment_offsets[i]] to segments[segment_offsets[i + 1]]
+	std::vector<uint32_t> segment_offsets;
+	std::vector<uint32_t> segments;
+	// 1 if the cell may contain visible data, uploaded to the GPU for the renderer
+	std::vector<uint8_t> occupied;
+
+	OccupancyGrid();
+	size_t num_cells() const;
+	/* Recompute which cells are occupied, returns true if any changed. A cell is occupied
+	 * if one of its segments is selected and the alpha of its palette is non-zero over
+	 * the cell's value range. Segments outside the selection are treated as selected
+	 * with palette 0, and segments using palettes we don't have the alpha for are
+	 * treated as visible.
+	 */
+	bool update_occupied(const std::vector<unsigned int> &selections, const std::vector<unsigned int> &palettes,
+			const PaletteCoverage &coverage);
+};
+
+/* Build the grid for the volume data in parallel over the cells, the segmentation
+ * may be null in which case all voxels are treated as being in segment 0.
+ * All cells are marked occupied until update_occupied is called.
+ */
+void build_occupancy_grid(vtkDataArray *data, vtkDataArray *segmentation,
+		const std::array<int, 3> &dims, OccupancyGrid &out);
+
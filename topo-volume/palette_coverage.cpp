@@ -0,0 +1,47 @@
+#include <algorithm>
+#include <cmath>
+#include "palette_coverage.h"
+
+PaletteCoverage::PaletteCoverage(const std::vector<uint8_t> &palette_alpha, const size_t palette_samples,
+		const float value_scale, const float value_bias)
+	: num_palettes(palette_samples > 0 ? palette_alpha.size() / palette_samples : 0),
+	samples(palette_samples), value_scale(value_scale), value_bias(value_bias),
+	isosurface(false), isovalue(0.f)
+{
+	alpha_prefix.resize(num_palettes * (samples + 1), 0);
+	for (size_t p = 0; p < num_palettes; ++p) {
+		uint32_t *prefix = alpha_prefix.data() + p * (samples + 1);
+		const uint8_t *alpha = palette_alpha.data() + p * samples;
+		for (size_t i = 0; i < samples; ++i) {
+			prefix[i + 1] = prefix[i] + (alpha[i] != 0 ? 1 : 0);
+		}
+	}
+}
+size_t PaletteCoverage::size() const {
+	return num_palettes;
+}
+void PaletteCoverage::set_isosurface(const float value) {
+	isosurface = true;
+	isovalue = value;
+}
+bool PaletteCoverage::visible(const size_t palette, const float lo, const float hi) const {
+	if (isosurface) {
+		return std::min(lo, hi) <= isovalue && isovalue <= std::max(lo, hi);
+	}
+	if (palette >= num_palettes) {
+		return true;
+	}
+	// Find the palette samples the values can be interpolated between, the palette
+	// is sampled with linear filtering so include the neighboring samples
+	const float s_lo = (lo * value_scale + value_bias) * samples - 0.5f;
+	const float s_hi = (hi * value_scale + value_bias) * samples - 0.5f;
+	if (!std::isfinite(s_lo) || !std::isfinite(s_hi)) {
+		return true;
+	}
+	const size_t sample_lo = static_cast<size_t>(std::max(std::floor(std::min(s_lo, s_hi)), 0.f));
+	const size_t sample_hi = static_cast<size_t>(std::max(std::ceil(std::max(s_lo, s_hi)), 0.f));
+	const size_t first = std::min(sample_lo, samples - 1);
+	const size_t last = std::min(sample_hi, samples - 1) + 1;
+	const uint32_t *prefix = alpha_prefix.data() + palette * (samples + 1);
+	return prefix[last] - prefix[first] != 0;
+}
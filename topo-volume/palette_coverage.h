@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/* Prefix sums of the non-zero alpha samples of each palette, used to check in
+ * constant time if a palette is transparent over a range of values. Values are
+ * mapped to the palette by value * value_scale + value_bias, as done by the shader.
+ * When rendering an isosurface only ranges containing the isovalue are visible.
+ */
+class PaletteCoverage {
+	std::vector<uint32_t> alpha_prefix;
+	size_t num_palettes, samples;
+	float value_scale, value_bias;
+	bool isosurface;
+	float isovalue;
+
+public:
+	// palette_alpha holds palette_samples alpha values for each palette
+	PaletteCoverage(const std::vector<uint8_t> &palette_alpha, const size_t palette_samples,
+			const float value_scale, const float value_bias);
+	size_t size() const;
+	// Switch to checking ranges against the isovalue instead of the palettes
+	void set_isosurface(const float isovalue);
+	/* Check if the palette has non-zero alpha anywhere values in [lo, hi] can map to,
+	 * including the neighboring samples used by linear filtering. Palettes we don't
+	 * have the alpha for and invalid ranges are treated as visible. For isosurfaces
+	 * this is if the range contains the isovalue
+	 */
+	bool visible(const size_t palette, const float lo, const float hi) const;
+};
+
@@ -0,0 +1,24 @@
+#include "palette_table.h"
+
+PaletteTable::PaletteTable(const size_t samples) : samples(samples) {}
+PaletteTable PaletteTable::ramp(const size_t samples) {
+	PaletteTable table(samples);
+	table.rgba.resize(samples * 4);
+	for (size_t i = 0; i < samples; ++i) {
+		const uint8_t x = static_cast<uint8_t>(samples > 1 ? i * 255 / (samples - 1) : 255);
+		for (size_t c = 0; c < 4; ++c) {
+			table.rgba[i * 4 + c] = x;
+		}
+	}
+	return table;
+}
+size_t PaletteTable::size() const {
+	return samples > 0 ? rgba.size() / (samples * 4) : 0;
+}
+std::vector<uint8_t> PaletteTable::alpha() const {
+	std::vector<uint8_t> out(rgba.size() / 4);
+	for (size_t i = 0; i < out.size(); ++i) {
+		out[i] = rgba[i * 4 + 3];
+	}
+	return out;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/* The RGBA8 samples of each palette laid out as in the palette texture, with
+ * samples values per palette. Kept on the CPU for rendering without GL.
+ */
+struct PaletteTable {
+	size_t samples;
+	std::vector<uint8_t> rgba;
+
+	PaletteTable(const size_t samples = 0);
+	// Make a single palette ramping from transparent black to opaque white
+	static PaletteTable ramp(const size_t samples);
+	size_t size() const;
+	// Get the alpha of each palette, with samples values per palette
+	std::vector<uint8_t> alpha() const;
+};
+
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The number of threads to use for our parallel loops, 0 means use
+// the hardware concurrency
+inline size_t& num_threads_setting() {
+	static size_t n = 0;
+	return n;
+}
+inline size_t get_num_threads() {
+	const size_t n = num_threads_setting();
+	if (n != 0) {
+		return n;
+	}
+	return std::max(size_t{1}, static_cast<size_t>(std::thread::hardware_concurrency()));
+}
+inline void set_num_threads(const size_t n) {
+	num_threads_setting() = n;
+}
+/* Run the function over [begin, end) split into blocks of at most grain items,
+ * the blocks are handed out dynamically to get_num_threads() threads. The function
+ * is called as fn(block_begin, block_end, thread_id), where thread_id is in
+ * [0, get_num_threads()) so callers can keep per thread data. If the function
+ * throws the remaining blocks are skipped and the exception is re-thrown on the
+ * calling thread.
+ */
+template<typename F>
+void parallel_for(const size_t begin, const size_t end, const size_t grain, const F &fn) {
+	if (begin >= end) {
+		return;
+	}
+	const size_t block_size = std::max(size_t{1}, grain);
+	const size_t num_blocks = (end - begin + block_size - 1) / block_size;
+	const size_t num_threads = std::min(get_num_threads(), num_blocks);
+
+	std::atomic<size_t> next_block(0);
+	std::atomic<bool> failed(false);
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	auto worker = [&](const size_t thread_id) {
+		try {
+			for (size_t b = next_block++; b < num_blocks && !failed; b = next_block++) {
+				const size_t block_begin = begin + b * block_size;
+				fn(block_begin, std::min(block_begin + block_size, end), thread_id);
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+			failed = true;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < num_threads; ++i) {
+		threads.emplace_back(worker, i);
+	}
+	worker(0);
+	for (auto &t : threads) {
+		t.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+/* Run fn(task, thread_id) for each task in [0, num_tasks) on get_num_threads() threads
+ * with work stealing. Each thread starts with a contiguous range of the tasks, so
+ * neighboring tasks tend to run on the same thread, and takes its tasks from the front
+ * of its range. A thread which runs out steals the back half of another thread's range.
+ * This balances tasks with very uneven costs, e.g. image tiles where some rays are much
+ * longer than others. Exceptions are handled as in parallel_for.
+ */
+template<typename F>
+void parallel_for_stealing(const size_t num_tasks, const F &fn) {
+	if (num_tasks == 0) {
+		return;
+	}
+	const size_t num_threads = std::min(get_num_threads(), num_tasks);
+	struct TaskRange {
+		std::mutex mutex;
+		size_t begin = 0, end = 0;
+	};
+	std::vector<TaskRange> ranges(num_threads);
+	for (size_t i = 0; i < num_threads; ++i) {
+		ranges[i].begin = i * num_tasks / num_threads;
+		ranges[i].end = (i + 1) * num_tasks / num_threads;
+	}
+
+	std::atomic<bool> failed(false);
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	auto worker = [&](const size_t thread_id) {
+		TaskRange &own = ranges[thread_id];
+		try {
+			while (!failed) {
+				size_t task = num_tasks;
+				{
+					std::lock_guard<std::mutex> lock(own.mutex);
+					if (own.begin < own.end) {
+						task = own.begin++;
+					}
+				}
+				if (task != num_tasks) {
+					fn(task, thread_id);
+					continue;
+				}
+				// Our range is empty, look for a thread with work left to steal from
+				size_t stolen_begin = 0, stolen_end = 0;
+				for (size_t i = 1; i < num_threads && stolen_begin == stolen_end; ++i) {
+					TaskRange &victim = ranges[(thread_id + i) % num_threads];
+					std::lock_guard<std::mutex> lock(victim.mutex);
+					if (victim.begin < victim.end) {
+						stolen_begin = victim.begin + (victim.end - victim.begin) / 2;
+						stolen_end = victim.end;
+						victim.end = stolen_begin;
+					}
+				}
+				// Tasks are never added, so if every range is empty we're done
+				if (stolen_begin == stolen_end) {
+					break;
+				}
+				std::lock_guard<std::mutex> lock(own.mutex);
+				own.begin = stolen_begin;
+				own.end = stolen_end;
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+			failed = true;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < num_threads; ++i) {
+		threads.emplace_back(worker, i);
+	}
+	worker(0);
+	for (auto &t : threads) {
+		t.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
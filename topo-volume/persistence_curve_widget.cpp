@@ -9,52 +9,24 @@
 #include <vtkUnstructuredGrid.h>
 #include "persistence_curve_widget.h"
 
-PersistenceCurveWidget::PersistenceCurveWidget(vtkImageData *data, unsigned int debug)
-  : tree_type(ttk::ftm::TreeType::Contour), debuglevel(debug)
+PersistenceCurveWidget::PersistenceCurveWidget(vtkImageData *data, unsigned int debug, TopologyCache *cache,
+	PipelineProfiler *profiler)
+  : pipeline(data, debug, cache, 0, profiler), tree_type(ttk::ftm::TreeType::Contour), debuglevel(debug)
 {
-    diagram = vtkSmartPointer<ttkPersistenceDiagram>::New();
-    diagram->SetdebugLevel_(debuglevel);
-    diagram->SetInputData(data);
-    //diagram->SetUseInputOffsetScalarField(false);
-
-    // Compute critical points
-    critical_pairs = vtkSmartPointer<vtkThreshold>::New();
-    critical_pairs->SetInputConnection(diagram->GetOutputPort());
-    critical_pairs->SetInputArrayToProcess(0, 0, 0, vtkDataObject::FIELD_ASSOCIATION_CELLS, "PairIdentifier");
-    critical_pairs->ThresholdBetween(-0.1, 999999);
-
-    // Select the most persistent pairs
-    persistent_pairs = vtkSmartPointer<vtkThreshold>::New();
-    persistent_pairs->SetInputConnection(critical_pairs->GetOutputPort());
-    persistent_pairs->SetInputArrayToProcess(0, 0, 0, vtkDataObject::FIELD_ASSOCIATION_CELLS, "Persistence");
+    pipeline.compute_diagram();
     // Start at a persistence above one so we filter out some junk
     threshold_range[0] = 4.f;
-    persistent_pairs->ThresholdBetween(threshold_range[0], 999999);
-
-    // Simplifying the input data to remove non-persistent pairs
-    simplification = vtkSmartPointer<ttkTopologicalSimplification>::New();
-    simplification->SetdebugLevel_(debuglevel);
-    simplification->SetUseAllCores(true);
-    simplification->SetThreadNumber(std::thread::hardware_concurrency());
-    //simplification->SetUseInputOffsetScalarField(false);
-    simplification->SetInputData(0, data);
-    simplification->SetInputConnection(1, persistent_pairs->GetOutputPort());
-
     // We always show the full curve, without simplfication for the
     // selected tree type
-    vtkcurve = vtkSmartPointer<ttkPersistenceCurve>::New();
-    vtkcurve->SetdebugLevel_(debuglevel);
-    vtkcurve->SetInputData(data);
-    vtkcurve->SetComputeSaddleConnectors(false);
-    vtkcurve->SetUseAllCores(true);
-    //vtkcurve->SetUseInputOffsetScalarField(false);
-    vtkcurve->SetThreadNumber(std::thread::hardware_concurrency());
-    vtkcurve->Update();
+    pipeline.compute_curves();
     update_persistence_curve();
     update_persistence_diagram();
 }
 ttkTopologicalSimplification* PersistenceCurveWidget::get_simplification() const {
-    return simplification.Get();
+    return pipeline.get_simplification();
+}
+const TopologyPipeline& PersistenceCurveWidget::get_pipeline() const {
+    return pipeline;
 }
 void PersistenceCurveWidget::draw_ui() {
     if (ImGui::Begin("Persistence Plots")) 
@@ -67,8 +39,7 @@ void PersistenceCurveWidget::draw_ui() {
 
 	// If we changed our selection update the display in the other widgets
 	if (ImGui::Button("Apply")) {
-	    persistent_pairs->ThresholdBetween(threshold_range[0], threshold_range[1]);
-	    simplification->Update();
+	    apply_threshold();
 	    update_persistence_diagram(); // update threshold
 	}
 
@@ -165,19 +136,7 @@ void PersistenceCurveWidget::set_tree_type(const ttk::ftm::TreeType &type) {
     }
 }
 void PersistenceCurveWidget::update_persistence_curve() {
-    // Tree type mapping to persistence curve output index:
-    // Join Tree: 0
-    // Morse Smale Curve: 1
-    // Split Tree: 2
-    // Contour Tree: 3
-    int tree = 0;
-    switch (tree_type) {
-    case ttk::ftm::TreeType::Contour: tree = 3; break;
-    case ttk::ftm::TreeType::Split: tree = 2; break;
-    case ttk::ftm::TreeType::Join: tree = 0; break;
-    default: break;
-    }
-    vtkTable* table = dynamic_cast<vtkTable*>(vtkcurve->GetOutputInformation(tree)->Get(vtkDataObject::DATA_OBJECT()));
+    vtkTable* table = pipeline.get_curve(tree_type);
     vtkDataArray *persistence_col = dynamic_cast<vtkDataArray*>(table->GetColumn(0));
     vtkDataArray *npairs_col      = dynamic_cast<vtkDataArray*>(table->GetColumn(1));
 
@@ -201,13 +160,15 @@ void PersistenceCurveWidget::update_persistence_curve() {
 	}
     }
     threshold_range[1] = persistence_range.y;
-    persistent_pairs->ThresholdBetween(threshold_range[0], threshold_range[1]);
-    simplification->Update();
+    apply_threshold();
+}
+void PersistenceCurveWidget::apply_threshold() {
+    pipeline.simplify(threshold_range[0], threshold_range[1], tree_type);
 }
 void PersistenceCurveWidget::update_persistence_diagram() 
 {
     diagram_lines.clear();
-    vtkUnstructuredGrid* dcells = vtkUnstructuredGrid::SafeDownCast(diagram->GetOutput());
+    vtkUnstructuredGrid* dcells = pipeline.get_diagram();
 
     if (debuglevel >= 1) {
 	std::cout << "[DrawPersistenceDiagram] persistence range " 
@@ -8,13 +8,13 @@
 // include the vtk headers
 #include <vtkSmartPointer.h>
 #include <vtkXMLImageDataReader.h>
-#include <vtkThreshold.h>
-#include <ttkPersistenceCurve.h>
-#include <ttkPersistenceDiagram.h>
-#include <ttkTopologicalSimplification.h>
+#include <vtkTable.h>
+#include <vtkUnstructuredGrid.h>
 // include the local headers
 #include <glm/glm.hpp>
 #include "imgui-1.49/imgui.h"
+#include "topology_cache.h"
+#include "topology_pipeline.h"
 
 /**
  * @brief render persistence curve
@@ -31,10 +31,8 @@ public:
 	double tnode[2];
     };
 private:
-    vtkSmartPointer<ttkPersistenceDiagram> diagram;
-    vtkSmartPointer<vtkThreshold> critical_pairs, persistent_pairs;
-    vtkSmartPointer<ttkTopologicalSimplification> simplification;
-    vtkSmartPointer<ttkPersistenceCurve> vtkcurve;
+    // Computes the diagram, curves and simplification shown and selected in the widget
+    TopologyPipeline pipeline;
     ttk::ftm::TreeType tree_type;
 
     // Data for the ui display
@@ -48,11 +46,16 @@ public:
     /**
      * @brief Setup the persistence curve display for the passed volume data. The
      * topological simplification selected by the user can then be gotten
-     * via `get_simplification`
+     * via `get_simplification`. If a cache is passed the diagram, curves and trees
+     * will be loaded from it when available instead of being recomputed. If a profiler
+     * is passed it records the pipeline's stages
      */
-    PersistenceCurveWidget(vtkImageData *data, unsigned int debug = 0);
+    PersistenceCurveWidget(vtkImageData *data, unsigned int debug = 0, TopologyCache *cache = nullptr,
+	    PipelineProfiler *profiler = nullptr);
     // Get the topological simplification resulting from the user's selection
     ttkTopologicalSimplification* get_simplification() const;
+    // Get the pipeline computing the topology, to build the tree on the simplified data
+    const TopologyPipeline& get_pipeline() const;
     /**
      * @brief plot curve
      */
@@ -68,5 +71,7 @@ private:
      */
     void update_persistence_curve();
     void update_persistence_diagram();
+    // Apply the threshold to the simplification, skipping it if the tree is cached
+    void apply_threshold();
 };
 
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include "process_stats.h"
+#include "pipeline_profiler.h"
+
+PipelineProfiler* PipelineProfiler::New() {
+	return new PipelineProfiler;
+}
+PipelineProfiler::PipelineProfiler() : epoch(std::chrono::steady_clock::now()) {}
+void PipelineProfiler::watch(vtkAlgorithm *filter, const std::string &name, const int threads) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		watched[filter] = Watch{name, threads};
+	}
+	filter->AddObserver(vtkCommand::StartEvent, this);
+	filter->AddObserver(vtkCommand::EndEvent, this);
+}
+std::vector<ProfileStage> PipelineProfiler::get_stages() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stages;
+}
+void PipelineProfiler::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	stages.clear();
+}
+void PipelineProfiler::write_chrome_trace(const std::string &file) const {
+	const std::vector<ProfileStage> trace = get_stages();
+	size_t num_threads = 0;
+	for (const auto &s : trace) {
+		num_threads = std::max(num_threads, s.thread + 1);
+	}
+
+	std::ofstream fout(file.c_str());
+	if (!fout) {
+		throw std::runtime_error("Failed to open " + file + " to write the trace");
+	}
+	// Times in the trace are in microseconds. The stage names are our filter names
+	// so they don't need escaping
+	fout << std::fixed << std::setprecision(3);
+	fout << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	for (size_t i = 0; i < num_threads; ++i) {
+		fout << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << i
+			<< ", \"args\": {\"name\": \"pipeline thread " << i << "\"}},\n";
+	}
+	for (size_t i = 0; i < trace.size(); ++i) {
+		const ProfileStage &s = trace[i];
+		fout << "{\"name\": \"" << s.name << "\", \"cat\": \"pipeline\", \"ph\": \"X\", \"pid\": 1"
+			<< ", \"tid\": " << s.thread << ", \"ts\": " << s.start * 1e6 << ", \"dur\": " << s.wall * 1e6
+			<< ", \"args\": {\"cpu_ms\": " << s.cpu * 1e3 << ", \"threads\": " << s.threads
+			<< ", \"rss_delta_mb\": " << s.rss_delta_mb << "}}"
+			<< (i + 1 < trace.size() ? ",\n" : "\n");
+	}
+	fout << "]}\n";
+	if (!fout) {
+		throw std::runtime_error("Failed to write the trace to " + file);
+	}
+}
+void PipelineProfiler::Execute(vtkObject *caller, unsigned long event_id, void*) {
+	// Sample the process stats outside the lock so waiting on it doesn't count to the stage
+	const auto now = std::chrono::steady_clock::now();
+	const double cpu = process_cpu_seconds();
+	const double rss = current_rss_mb();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto w = watched.find(caller);
+	if (w == watched.end()) {
+		return;
+	}
+	if (event_id == vtkCommand::StartEvent) {
+		open_stages[caller] = OpenStage{now, cpu, rss};
+		return;
+	}
+	// Cached results are announced with just an EndEvent, the filter didn't run
+	auto open = open_stages.find(caller);
+	if (event_id != vtkCommand::EndEvent || open == open_stages.end()) {
+		return;
+	}
+	using namespace std::chrono;
+	auto tid = thread_ids.find(std::this_thread::get_id());
+	if (tid == thread_ids.end()) {
+		tid = thread_ids.emplace(std::this_thread::get_id(), thread_ids.size()).first;
+	}
+	ProfileStage stage;
+	stage.name = w->second.name;
+	stage.start = duration_cast<duration<double>>(open->second.start - epoch).count();
+	stage.wall = duration_cast<duration<double>>(now - open->second.start).count();
+	stage.cpu = cpu - open->second.cpu_start;
+	stage.threads = w->second.threads;
+	stage.rss_delta_mb = rss - open->second.rss_start;
+	stage.thread = tid->second;
+	stages.push_back(stage);
+	open_stages.erase(open);
+}
+
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vtkCommand.h>
+#include <vtkAlgorithm.h>
+
+// The time and resources used by one execution of a watched filter
+struct ProfileStage {
+	std::string name;
+	// Start time relative to the profiler's creation, and the wall and CPU time taken, in seconds
+	double start, wall, cpu;
+	// The number of threads the filter was set to use
+	int threads;
+	// Change in the process' resident memory over the stage in MB
+	double rss_delta_mb;
+	// Index of the thread which ran the filter, in the order threads were first seen
+	size_t thread;
+};
+
+/* Profiles the VTK/TTK filters it watches through their StartEvent and EndEvent,
+ * recording each time a filter executes as a stage. The pipeline runs implicitly
+ * through updates triggered by other filters, so this shows where the time goes
+ * without instrumenting each call. The CPU time and memory are measured for the
+ * whole process, so they include other threads working while the filter runs.
+ * Events may come from the loader and render threads so the stages are locked.
+ */
+class PipelineProfiler : public vtkCommand {
+	struct Watch {
+		std::string name;
+		int threads;
+	};
+	struct OpenStage {
+		std::chrono::steady_clock::time_point start;
+		double cpu_start, rss_start;
+	};
+
+	std::chrono::steady_clock::time_point epoch;
+	mutable std::mutex mutex;
+	std::unordered_map<vtkObject*, Watch> watched;
+	std::unordered_map<vtkObject*, OpenStage> open_stages;
+	std::unordered_map<std::thread::id, size_t> thread_ids;
+	std::vector<ProfileStage> stages;
+
+public:
+	static PipelineProfiler* New();
+	// Record the executions of the filter as stages with the name
+	void watch(vtkAlgorithm *filter, const std::string &name, const int threads);
+	// Get a copy of the stages recorded so far, ordered by when they finished
+	std::vector<ProfileStage> get_stages() const;
+	void clear();
+	/* Write the stages as Chrome trace events, which can be viewed in chrome://tracing
+	 * or Perfetto. Throws if the file can't be written
+	 */
+	void write_chrome_trace(const std::string &file) const;
+	void Execute(vtkObject *caller, unsigned long event_id, void *call_data) override;
+
+protected:
+	PipelineProfiler();
+};
+
@@ -0,0 +1,12 @@
+#pragma once
+
+/* Resource use of the whole process, used to profile the pipeline stages.
+ * Each returns 0 if the platform doesn't report it.
+ */
+// The user + system CPU time used by all threads of the process so far, in seconds
+double process_cpu_seconds();
+// The current resident memory of the process in MB
+double current_rss_mb();
+// The peak resident memory of the process so far in MB
+double peak_rss_mb();
+
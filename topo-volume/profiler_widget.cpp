@@ -0,0 +1,58 @@
+#include <cstring>
+#include <stdexcept>
+#include "imgui-1.49/imgui.h"
+#include "profiler_widget.h"
+
+ProfilerWidget::ProfilerWidget(PipelineProfiler *profiler) : profiler(profiler) {
+	trace_file.fill('\0');
+	std::strncpy(trace_file.data(), "pipeline_trace.json", trace_file.size() - 1);
+}
+void ProfilerWidget::draw_ui() {
+	if (!ImGui::Begin("Pipeline Profiler")) {
+		ImGui::End();
+		return;
+	}
+	const std::vector<ProfileStage> stages = profiler->get_stages();
+	double total_wall = 0.0, total_cpu = 0.0;
+	ImGui::Columns(6, "stages");
+	ImGui::Text("Stage"); ImGui::NextColumn();
+	ImGui::Text("Wall ms"); ImGui::NextColumn();
+	ImGui::Text("CPU ms"); ImGui::NextColumn();
+	ImGui::Text("CPU/Wall"); ImGui::NextColumn();
+	ImGui::Text("Threads"); ImGui::NextColumn();
+	ImGui::Text("RSS delta MB"); ImGui::NextColumn();
+	ImGui::Separator();
+	for (const auto &s : stages) {
+		// CPU/Wall shows how many cores the stage kept busy
+		ImGui::Text("%s", s.name.c_str()); ImGui::NextColumn();
+		ImGui::Text("%.2f", s.wall * 1000.0); ImGui::NextColumn();
+		ImGui::Text("%.2f", s.cpu * 1000.0); ImGui::NextColumn();
+		ImGui::Text("%.2f", s.wall > 0.0 ? s.cpu / s.wall : 0.0); ImGui::NextColumn();
+		ImGui::Text("%d", s.threads); ImGui::NextColumn();
+		ImGui::Text("%+.1f", s.rss_delta_mb); ImGui::NextColumn();
+		total_wall += s.wall;
+		total_cpu += s.cpu;
+	}
+	ImGui::Columns(1);
+	ImGui::Separator();
+	ImGui::Text("%lu stages, %.2f ms wall, %.2f ms CPU", static_cast<unsigned long>(stages.size()),
+			total_wall * 1000.0, total_cpu * 1000.0);
+
+	ImGui::InputText("Trace File", trace_file.data(), trace_file.size());
+	if (ImGui::Button("Export Chrome Trace")) {
+		try {
+			profiler->write_chrome_trace(trace_file.data());
+			export_status = std::string("Wrote ") + trace_file.data();
+		} catch (const std::exception &e) {
+			export_status = e.what();
+		}
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Clear")) {
+		profiler->clear();
+	}
+	if (!export_status.empty()) {
+		ImGui::TextWrapped("%s", export_status.c_str());
+	}
+	ImGui::End();
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include "pipeline_profiler.h"
+
+// Shows the stages recorded by the pipeline profiler and exports them as a Chrome trace
+class ProfilerWidget {
+	PipelineProfiler *profiler;
+	std::array<char, 256> trace_file;
+	// Result of the last export, shown under the button
+	std::string export_status;
+
+public:
+	ProfilerWidget(PipelineProfiler *profiler);
+	void draw_ui();
+};
+
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cmath>
+#include <SDL.h>
+#include "quality_controller.h"
+
+constexpr float QualityController::MIN_RESOLUTION_SCALE;
+constexpr float QualityController::MAX_STEP_SCALE;
+
+// The lowest quality we scale down to, at the minimum resolution and max step
+static const float MIN_QUALITY = QualityController::MIN_RESOLUTION_SCALE * QualityController::MIN_RESOLUTION_SCALE
+	/ QualityController::MAX_STEP_SCALE;
+
+QualityController::QualityController(const float target_ms)
+	: next_query(0), timing(false), target_ms(target_ms), pass_ms(0.f), quality(1.f),
+	last_interaction(0), interacting(false), enabled(true)
+{
+	glGenQueries(NUM_QUERIES, queries.data());
+	query_quality.fill(-1.f);
+}
+QualityController::~QualityController() {
+	glDeleteQueries(NUM_QUERIES, queries.data());
+}
+void QualityController::update(const bool camera_moved) {
+	// Read back the timings that are ready, in the order they were issued
+	for (size_t i = 0; i < NUM_QUERIES; ++i) {
+		const size_t q = (next_query + i) % NUM_QUERIES;
+		if (query_quality[q] < 0.f) {
+			continue;
+		}
+		GLint available = 0;
+		glGetQueryObjectiv(queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			break;
+		}
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queries[q], GL_QUERY_RESULT, &elapsed);
+		pass_ms = elapsed / 1e6f;
+		// The cost scales roughly linearly with the quality it was rendered at, so estimate
+		// the quality that would hit the target. Damp the change to avoid oscillating
+		if (pass_ms > 0.f) {
+			const float estimate = query_quality[q] * target_ms / pass_ms;
+			quality = std::min(std::max(std::sqrt(quality * estimate), MIN_QUALITY), 1.f);
+		}
+		query_quality[q] = -1.f;
+	}
+
+	const uint32_t now = SDL_GetTicks();
+	if (camera_moved) {
+		last_interaction = now;
+		interacting = true;
+	} else if (interacting && now - last_interaction > INTERACTION_TIMEOUT_MS) {
+		interacting = false;
+	}
+}
+void QualityController::begin_pass() {
+	// If the query we'd reuse hasn't been read back yet skip timing this frame
+	timing = query_quality[next_query] < 0.f;
+	if (timing) {
+		glBeginQuery(GL_TIME_ELAPSED, queries[next_query]);
+	}
+}
+void QualityController::end_pass() {
+	if (!timing) {
+		return;
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+	query_quality[next_query] = resolution_scale() * resolution_scale() / step_scale();
+	next_query = (next_query + 1) % NUM_QUERIES;
+	timing = false;
+}
+float QualityController::step_scale() const {
+	if (!enabled || !interacting) {
+		return 1.f;
+	}
+	return std::min(1.f / std::cbrt(quality), MAX_STEP_SCALE);
+}
+float QualityController::resolution_scale() const {
+	if (!enabled || !interacting) {
+		return 1.f;
+	}
+	return std::max(std::cbrt(quality), MIN_RESOLUTION_SCALE);
+}
+bool QualityController::is_interacting() const {
+	return enabled && interacting;
+}
+float QualityController::last_pass_ms() const {
+	return pass_ms;
+}
+float QualityController::get_target_ms() const {
+	return target_ms;
+}
+void QualityController::set_target_ms(const float ms) {
+	target_ms = ms;
+}
+
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "glt/gl_core_4_5.h"
+
+/* Adjusts the volume's sampling step and render resolution while the camera is
+ * moving to keep the volume pass within a frame time target. The pass is timed with
+ * GL timer queries, which are read back a few frames later to avoid stalling.
+ * From each timing we estimate the quality, as a fraction of the full quality cost,
+ * that would hit the target. The cost is split evenly between a larger step and a
+ * lower resolution, and full quality is restored once the camera stops moving.
+ */
+class QualityController {
+public:
+	static const size_t NUM_QUERIES = 4;
+	static constexpr float MIN_RESOLUTION_SCALE = 0.25f;
+	static constexpr float MAX_STEP_SCALE = 4.f;
+	// How long after the camera stops moving we return to full quality
+	static const uint32_t INTERACTION_TIMEOUT_MS = 200;
+
+private:
+	std::array<GLuint, NUM_QUERIES> queries;
+	// The quality each pending query was rendered at, or a negative value if it's not in use
+	std::array<float, NUM_QUERIES> query_quality;
+	size_t next_query;
+	bool timing;
+	float target_ms, pass_ms, quality;
+	uint32_t last_interaction;
+	bool interacting;
+
+public:
+	bool enabled;
+
+	QualityController(const float target_ms);
+	~QualityController();
+	QualityController(const QualityController&) = delete;
+	QualityController& operator=(const QualityController&) = delete;
+	/* Read back any finished timings and update the quality, call once per frame
+	 * before rendering. camera_moved should be true if the camera changed this frame
+	 */
+	void update(const bool camera_moved);
+	// Time the volume pass between begin_pass and end_pass
+	void begin_pass();
+	void end_pass();
+	// The multiplier to apply to the sampling step, 1 is full quality
+	float step_scale() const;
+	// The fraction of the window resolution to render the volume at, 1 is full quality
+	float resolution_scale() const;
+	// Check if we're currently rendering at reduced quality for interaction
+	bool is_interacting() const;
+	// The most recent GPU time of the volume pass in ms
+	float last_pass_ms() const;
+	float get_target_ms() const;
+	void set_target_ms(const float ms);
+};
+
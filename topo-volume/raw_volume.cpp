@@ -0,0 +1,235 @@
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <vtkDataArray.h>
+#include <vtkPointData.h>
+#include "parallel.h"
+#include "raw_volume.h"
+
+// Alignment required for O_DIRECT reads, chunks are also rounded to this size
+static const size_t IO_ALIGNMENT = 4096;
+
+#ifndef _WIN32
+// VTK only gives the free function the pointer, so we track the size of each
+// mapping here to be able to unmap it later
+static std::mutex mapping_mutex;
+static std::unordered_map<void*, size_t> mapping_sizes;
+
+static void unmap_array(void *ptr) {
+	std::lock_guard<std::mutex> lock(mapping_mutex);
+	auto fnd = mapping_sizes.find(ptr);
+	if (fnd != mapping_sizes.end()) {
+		munmap(ptr, fnd->second);
+		mapping_sizes.erase(fnd);
+	}
+}
+#endif
+
+static vtkSmartPointer<vtkImageData> make_volume(const std::array<int, 3> &dims,
+		vtkDataArray *array)
+{
+	vtkSmartPointer<vtkImageData> vol = vtkSmartPointer<vtkImageData>::New();
+	vol->SetDimensions(dims[0], dims[1], dims[2]);
+	vol->SetSpacing(1, 1, 1);
+	vol->SetOrigin(0, 0, 0);
+	vol->GetPointData()->SetScalars(array);
+	return vol;
+}
+template<typename T>
+static void swap_elements(T *data, const size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		uint8_t *b = reinterpret_cast<uint8_t*>(data + i);
+		std::reverse(b, b + sizeof(T));
+	}
+}
+static void swap_bytes_inplace(char *data, const size_t size, const int elem_size) {
+	switch (elem_size) {
+		case 2: swap_elements(reinterpret_cast<uint16_t*>(data), size / 2); break;
+		case 4: swap_elements(reinterpret_cast<uint32_t*>(data), size / 4); break;
+		case 8: swap_elements(reinterpret_cast<uint64_t*>(data), size / 8); break;
+		default: break;
+	}
+}
+
+bool host_is_little_endian() {
+	const uint16_t x = 1;
+	return *reinterpret_cast<const uint8_t*>(&x) == 1;
+}
+vtkSmartPointer<vtkImageData> map_raw_volume(const std::string &file,
+		const std::array<int, 3> &dims, const int vtk_data_type)
+{
+#ifdef _WIN32
+	return nullptr;
+#else
+	const size_t num_voxels = size_t(dims[0]) * size_t(dims[1]) * size_t(dims[2]);
+	const size_t expected_size = num_voxels * vtkDataArray::GetDataTypeSize(vtk_data_type);
+
+	const int fd = open(file.c_str(), O_RDONLY);
+	if (fd == -1) {
+		std::cerr << "Failed to open " << file << " for mapping\n";
+		return nullptr;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < expected_size) {
+		std::cerr << "Raw file " << file << " is smaller than its dimensions and type require\n";
+		close(fd);
+		return nullptr;
+	}
+	// VTK filters may write to their input's scalars, a private writable mapping makes
+	// those writes copy on write so they never reach the file
+	void *data = mmap(nullptr, expected_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file
+	close(fd);
+	if (data == MAP_FAILED) {
+		std::cerr << "Failed to mmap " << file << "\n";
+		return nullptr;
+	}
+	// We'll stream through the file front to back computing the topology. The pages are
+	// left to be read in lazily so large volumes don't have to fit in memory up front
+	madvise(data, expected_size, MADV_SEQUENTIAL);
+	{
+		std::lock_guard<std::mutex> lock(mapping_mutex);
+		mapping_sizes[data] = expected_size;
+	}
+
+	vtkSmartPointer<vtkDataArray> array = vtkSmartPointer<vtkDataArray>::Take(
+			vtkDataArray::CreateDataArray(vtk_data_type));
+	array->SetName("ImageFile");
+	array->SetNumberOfComponents(1);
+	array->SetVoidArray(data, num_voxels, 0, vtkAbstractArray::VTK_DATA_ARRAY_USER_DEFINED);
+	array->SetArrayFreeFunction(unmap_array);
+	return make_volume(dims, array);
+#endif
+}
+vtkSmartPointer<vtkImageData> read_raw_volume_parallel(const std::string &file,
+		const std::array<int, 3> &dims, const int vtk_data_type, const bool swap_bytes,
+		const size_t chunk_size, const unsigned int debuglevel, const std::atomic<bool> *cancel)
+{
+#ifdef _WIN32
+	throw std::runtime_error("The parallel RAW reader is not supported on Windows");
+#else
+	using namespace std::chrono;
+	const auto start = steady_clock::now();
+
+	const int elem_size = vtkDataArray::GetDataTypeSize(vtk_data_type);
+	const size_t num_voxels = size_t(dims[0]) * size_t(dims[1]) * size_t(dims[2]);
+	const size_t expected_size = num_voxels * elem_size;
+	const size_t chunk = std::max(IO_ALIGNMENT, chunk_size / IO_ALIGNMENT * IO_ALIGNMENT);
+	const size_t num_chunks = (expected_size + chunk - 1) / chunk;
+
+	const int fd = open(file.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open raw file " + file);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < expected_size) {
+		close(fd);
+		throw std::runtime_error("Raw file " + file + " is smaller than its dimensions and type require");
+	}
+	// Not all file systems support O_DIRECT, if it fails we just use the buffered descriptor
+	int direct_fd = -1;
+#ifdef O_DIRECT
+	direct_fd = open(file.c_str(), O_RDONLY | O_DIRECT);
+#endif
+	if (direct_fd == -1) {
+		posix_fadvise(fd, 0, expected_size, POSIX_FADV_SEQUENTIAL);
+	}
+
+	// The O_DIRECT read of the last chunk is rounded up to the alignment, so pad the array to fit it
+	const size_t alloc_size = (expected_size + IO_ALIGNMENT - 1) / IO_ALIGNMENT * IO_ALIGNMENT;
+	void *data = nullptr;
+	if (posix_memalign(&data, IO_ALIGNMENT, alloc_size) != 0) {
+		close(fd);
+		if (direct_fd != -1) {
+			close(direct_fd);
+		}
+		throw std::runtime_error("Failed to allocate " + std::to_string(alloc_size) + "b for " + file);
+	}
+	char *bytes = static_cast<char*>(data);
+
+	std::atomic<bool> direct_failed(false);
+	try {
+		parallel_for(0, num_chunks, 1, [&](const size_t begin, const size_t end, const size_t) {
+			for (size_t c = begin; c < end; ++c) {
+				if (cancel && *cancel) {
+					throw std::runtime_error("Reading " + file + " was cancelled");
+				}
+				const size_t offset = c * chunk;
+				const size_t size = std::min(chunk, expected_size - offset);
+				size_t read_bytes = 0;
+				if (direct_fd != -1 && !direct_failed) {
+					const size_t aligned_size = (size + IO_ALIGNMENT - 1) / IO_ALIGNMENT * IO_ALIGNMENT;
+					while (read_bytes < size) {
+						const ssize_t r = pread(direct_fd, bytes + offset + read_bytes,
+								aligned_size - read_bytes, offset + read_bytes);
+						if (r <= 0) {
+							// Some file systems accept the flag at open but fail the reads
+							direct_failed = true;
+							break;
+						}
+						read_bytes += r;
+						// A short read leaves us unaligned for O_DIRECT, finish it buffered
+						if (read_bytes % IO_ALIGNMENT != 0) {
+							break;
+						}
+					}
+				}
+				while (read_bytes < size) {
+					const ssize_t r = pread(fd, bytes + offset + read_bytes, size - read_bytes,
+							offset + read_bytes);
+					if (r <= 0) {
+						throw std::runtime_error("Failed to read chunk " + std::to_string(c)
+								+ " of " + file + ": " + std::strerror(errno));
+					}
+					read_bytes += r;
+				}
+				if (swap_bytes) {
+					swap_bytes_inplace(bytes + offset, size, elem_size);
+				}
+			}
+		});
+	} catch (...) {
+		close(fd);
+		if (direct_fd != -1) {
+			close(direct_fd);
+		}
+		free(data);
+		throw;
+	}
+	close(fd);
+	if (direct_fd != -1) {
+		close(direct_fd);
+	}
+
+	if (debuglevel >= 1) {
+		const double elapsed = duration_cast<duration<double>>(steady_clock::now() - start).count();
+		std::cerr << "[RawReader] read " << expected_size / 1e6 << "MB in " << num_chunks
+			<< " chunks of " << chunk / 1e6 << "MB with " << std::min(get_num_threads(), num_chunks)
+			<< " threads" << (direct_fd != -1 && !direct_failed ? " (O_DIRECT)" : "")
+			<< ": " << expected_size / 1e6 / elapsed << "MB/s\n";
+	}
+
+	vtkSmartPointer<vtkDataArray> array = vtkSmartPointer<vtkDataArray>::Take(
+			vtkDataArray::CreateDataArray(vtk_data_type));
+	array->SetName("ImageFile");
+	array->SetNumberOfComponents(1);
+	array->SetVoidArray(data, num_voxels, 0, vtkAbstractArray::VTK_DATA_ARRAY_FREE);
+	return make_volume(dims, array);
+#endif
+}
+
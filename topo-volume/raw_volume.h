@@ -0,0 +1,33 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <vtkSmartPointer.h>
+#include <vtkImageData.h>
+
+// Check if the host we're running on is little endian
+bool host_is_little_endian();
+/* Memory map a RAW volume file and hand the mapping to VTK directly, without
+ * copying it into a new buffer. The mapping is private and copy on write, so
+ * writes to the array don't modify the file, and is unmapped when
+ * VTK releases the data array. The scalar array is named "ImageFile" to match
+ * what vtkImageReader2 produces. Returns null if the file can't be mapped or
+ * its size doesn't match the dimensions and data type, in which case the
+ * caller should fall back to reading the file.
+ */
+vtkSmartPointer<vtkImageData> map_raw_volume(const std::string &file,
+		const std::array<int, 3> &dims, const int vtk_data_type);
+/* Read a RAW volume with a pool of threads, for file systems where mmap performs
+ * poorly. The file is split into chunks of chunk_size bytes (rounded to the page
+ * size) which the threads read with pread straight into the volume's array,
+ * using O_DIRECT where it's supported. If swap_bytes is set each chunk is byte
+ * swapped by the thread which read it, while other chunks are still being read.
+ * The achieved bandwidth is reported at debug level 1. If the cancel flag is
+ * passed and gets set while reading the read is stopped and an exception thrown.
+ */
+vtkSmartPointer<vtkImageData> read_raw_volume_parallel(const std::string &file,
+		const std::array<int, 3> &dims, const int vtk_data_type, const bool swap_bytes,
+		const size_t chunk_size, const unsigned int debuglevel = 0,
+		const std::atomic<bool> *cancel = nullptr);
+
@@ -0,0 +1,97 @@
+#include <array>
+#include <stdexcept>
+#include "glt/util.h"
+#include "render_target.h"
+
+RenderTarget::RenderTarget() : fbo(0), color(0), depth(0), width(0), height(0) {
+	glGenFramebuffers(1, &fbo);
+	glGenTextures(1, &color);
+	glGenRenderbuffers(1, &depth);
+	// The composite pass draws a single triangle generated in the vertex shader
+	// but core profile still requires a vao to be bound
+	glGenVertexArrays(1, &vao);
+
+	const std::string resource_path = glt::get_resource_path();
+	composite_shader = glt::load_program({std::make_pair(GL_VERTEX_SHADER, resource_path + "composite_vert.glsl"),
+			std::make_pair(GL_FRAGMENT_SHADER, resource_path + "composite_frag.glsl")});
+	if (composite_shader == static_cast<GLuint>(-1)) {
+		throw std::runtime_error("Failed to load the composite shader");
+	}
+	glUseProgram(composite_shader);
+	glUniform1i(glGetUniformLocation(composite_shader, "image"), COMPOSITE_TEXTURE_UNIT);
+}
+RenderTarget::~RenderTarget() {
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &color);
+	glDeleteRenderbuffers(1, &depth);
+	glDeleteVertexArrays(1, &vao);
+	glDeleteProgram(composite_shader);
+}
+void RenderTarget::resize(const int w, const int h) {
+	if (w == width && h == height) {
+		return;
+	}
+	width = w;
+	height = h;
+	glActiveTexture(GL_TEXTURE0 + COMPOSITE_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, color);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+	// Linear filtering so lower resolution renders are smoothly upscaled when composited
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		throw std::runtime_error("Offscreen render target framebuffer is incomplete");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+void RenderTarget::bind() {
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, width, height);
+}
+void RenderTarget::clear() {
+	const std::array<float, 4> transparent = {0.f, 0.f, 0.f, 0.f};
+	const float far_depth = 1.f;
+	glClearBufferfv(GL_COLOR, 0, transparent.data());
+	glClearBufferfv(GL_DEPTH, 0, &far_depth);
+}
+void RenderTarget::composite() {
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	draw_texture(color);
+}
+void RenderTarget::blend(const RenderTarget &src, const float weight) {
+	bind();
+	glEnable(GL_BLEND);
+	glBlendColor(0.f, 0.f, 0.f, weight);
+	glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+	draw_texture(src.color);
+}
+int RenderTarget::get_width() const {
+	return width;
+}
+int RenderTarget::get_height() const {
+	return height;
+}
+GLuint RenderTarget::color_texture() const {
+	return color;
+}
+void RenderTarget::draw_texture(GLuint texture) {
+	glActiveTexture(GL_TEXTURE0 + COMPOSITE_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glUseProgram(composite_shader);
+	glBindVertexArray(vao);
+
+	glDisable(GL_DEPTH_TEST);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glEnable(GL_DEPTH_TEST);
+}
+
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "glt/gl_core_4_5.h"
+
+/* An offscreen framebuffer the volume is rendered into, which can be at a lower
+ * resolution than the window and is composited over the window's framebuffer.
+ * The color buffer is RGBA16F with premultiplied alpha. A GL context must be
+ * current when the target is created
+ */
+class RenderTarget {
+	GLuint fbo, color, depth, composite_shader, vao;
+	int width, height;
+
+public:
+	// The texture unit the color buffer is bound to when compositing
+	static const int COMPOSITE_TEXTURE_UNIT = 6;
+
+	RenderTarget();
+	~RenderTarget();
+	RenderTarget(const RenderTarget&) = delete;
+	RenderTarget& operator=(const RenderTarget&) = delete;
+	// Resize the color and depth buffers, does nothing if the size is unchanged
+	void resize(const int width, const int height);
+	// Bind the framebuffer and set the viewport to cover it
+	void bind();
+	// Clear the color to transparent and reset the depth, the target must be bound
+	void clear();
+	/* Draw the color buffer scaled over the currently bound framebuffer and
+	 * viewport, blending it over what's there with premultiplied alpha
+	 */
+	void composite();
+	/* Blend the source target's color buffer into this one with the given weight,
+	 * as color = weight * src + (1 - weight) * color. Averages frames rendered into
+	 * src when the weight for frame n (from 0) is 1 / (n + 1). Binds this target
+	 */
+	void blend(const RenderTarget &src, const float weight);
+	int get_width() const;
+	int get_height() const;
+	GLuint color_texture() const;
+
+private:
+	// Draw the texture over the bound framebuffer with the composite shader, using the current blend state
+	void draw_texture(GLuint texture);
+};
+
@@ -0,0 +1,13 @@
+#version 430 core
+
+// The offscreen image to composite, with premultiplied alpha
+uniform sampler2D image;
+
+in vec2 uv;
+
+out vec4 color;
+
+void main(void){
+	color = texture(image, uv);
+}
+
@@ -0,0 +1,11 @@
+#version 430 core
+
+out vec2 uv;
+
+// Draw a triangle covering the screen, with no vertex buffer needed
+void main(void){
+	const vec2 pos = vec2(gl_VertexID % 2, gl_VertexID / 2) * 4.0 - 1.0;
+	uv = pos * 0.5 + 0.5;
+	gl_Position = vec4(pos, 0, 1);
+}
+
@@ -2,15 +2,46 @@
 
 #include "vol_global.glsl"
 
+// The shader is specialized with defines for the volume being rendered: INT_TEXTURE
+// if the volume is an integer texture, HAS_SEGMENTATION if there's a segmentation
+// and BRICKED if the volume and segmentation are stored in brick atlases.
+// PREINTEGRATED classifies the segments between samples with the pre-integrated palettes
+#ifdef INT_TEXTURE
+uniform isampler3D volume;
+#else
 uniform sampler3D volume;
-uniform isampler3D ivolume;
+#endif
 uniform sampler1DArray palette;
-uniform isampler3D segmentation_volume;
+#ifdef PREINTEGRATED
+// The palette averaged between each (front, back) pair of values, a layer per palette
+uniform sampler2DArray preint_palette;
+#endif
+#ifdef HAS_SEGMENTATION
+// The segment ids, narrowed to the smallest unsigned format that fits them
+uniform usampler3D segmentation_volume;
+// The palette + 1 of each segment if it's selected, or 0 if it isn't
+uniform usamplerBuffer segment_table;
+#endif
+// Macrocell grid marking which cells may contain visible data
+uniform usampler3D occupancy;
+uniform int macrocell_size;
+#ifdef BRICKED
+// The volume and segmentation textures are atlases of bricks, and
+// the page table gives the slot + 1 of each brick in the atlas
+uniform usampler3D page_table;
+uniform int brick_size;
+uniform ivec3 atlas_slots;
+uniform vec3 atlas_dim;
+#endif
 
-uniform bool has_segmentation_volume;
+// Render the first crossing of the isovalue along each ray as an opaque surface
+// instead of compositing the volume. The isovalue is in the same space as value_at()
 uniform bool isosurface;
 uniform float isovalue;
-uniform bool int_texture;
+// Multiplier for the sampling step, increased to render faster while interacting
+uniform float step_scale;
+// Changed each frame when averaging frames, to offset the ray start jitter
+uniform int frame_seed;
 
 in vec3 vray_dir;
 flat in vec3 transformed_eye;
@@ -23,38 +54,119 @@ float rand(vec2 co){
 	return fract(sin(dot(co.xy, vec2(12.9898,78.233))) * 43758.5453);
 }
 
-bool segment_selected(vec3 p, out uint palette) {
-	palette = 0;
-	if (has_segmentation_volume) {
-		const int segment = texture(segmentation_volume, p).r;
-		palette = segment_selections[segment * 2 + 1];
-		return segment_selections[segment * 2] != 0;
+#ifdef BRICKED
+// Find the position of p in the brick atlas, returns false if its brick isn't resident
+bool atlas_coord(vec3 p, out vec3 atlas_p) {
+	const vec3 v = clamp(p, vec3(0), vec3(1)) * vol_dim;
+	const ivec3 brick = min(ivec3(v) / brick_size, textureSize(page_table, 0) - 1);
+	const uint slot = texelFetch(page_table, brick, 0).r;
+	if (slot == 0) {
+		return false;
 	}
+	const int s = int(slot) - 1;
+	const ivec3 slot_pos = ivec3(s % atlas_slots.x, (s / atlas_slots.x) % atlas_slots.y,
+			s / (atlas_slots.x * atlas_slots.y));
+	// Offset by the apron to get to the brick's first voxel in the slot
+	atlas_p = (vec3(slot_pos * (brick_size + 2) + 1) + v - vec3(brick * brick_size)) / atlas_dim;
+	return true;
+}
+
+// Clamp p to the brick containing anchor
+vec3 clamp_to_brick(vec3 p, vec3 anchor) {
+	const ivec3 brick = min(ivec3(clamp(anchor, vec3(0), vec3(1)) * vol_dim) / brick_size,
+			textureSize(page_table, 0) - 1);
+	const vec3 lo = vec3(brick * brick_size);
+	// Stay just inside the brick's far faces so the clamped point maps back to it
+	const vec3 hi = min(vec3((brick + 1) * brick_size), vol_dim) - 1e-3;
+	return clamp(p * vol_dim, lo, hi) / vol_dim;
+}
+#endif
+
+// Find the texture coordinates to sample the volume at for p, returns false
+// if the volume isn't resident there
+bool texture_coord(vec3 p, out vec3 tex_p) {
+#ifdef BRICKED
+	return atlas_coord(p, tex_p);
+#else
+	tex_p = p;
 	return true;
+#endif
+}
+
+// Check if the segment at the texture coordinates is selected and get its palette
+bool segment_selected(vec3 tex_p, out uint palette) {
+#ifdef HAS_SEGMENTATION
+	const uint entry = texelFetch(segment_table, int(texture(segmentation_volume, tex_p).r)).r;
+	palette = max(entry, 1u) - 1u;
+	return entry != 0;
+#else
+	palette = 0;
+	return true;
+#endif
+}
+
+float value_at(vec3 tex_p) {
+	return scale_bias.x * texture(volume, tex_p).r + scale_bias.y;
 }
 
-float value(vec3 p) {
-	if (!int_texture) {
-		return scale_bias.x * texture(volume, p).r + scale_bias.y;
-	} else {
-		return scale_bias.x * texture(ivolume, p).r + scale_bias.y;
+// Sample the value at p, or if it's not resident at the closest point to it in the
+// brick of anchor, which must be resident. Used by the isosurface so the refinement
+// and gradient don't treat missing bricks as 0
+float value_near(vec3 p, vec3 anchor) {
+	vec3 tex_p;
+	if (texture_coord(p, tex_p)) {
+		return value_at(tex_p);
 	}
+#ifdef BRICKED
+	texture_coord(clamp_to_brick(p, anchor), tex_p);
+#endif
+	return value_at(tex_p);
 }
 
-vec3 grad(vec3 p, float dt) {
+vec3 grad(vec3 p, float dt, vec3 anchor) {
 	vec2 h = vec2(dt, 0.0);
-	return vec3(value(p + h.xyy) - value(p - h.xyy),
-		value(p + h.yxy) - value(p - h.yxy),
-		value(p + h.yyx) - value(p - h.yyx)) / (2.0*h.x);
+	return vec3(value_near(p + h.xyy, anchor) - value_near(p - h.xyy, anchor),
+		value_near(p + h.yxy, anchor) - value_near(p - h.yxy, anchor),
+		value_near(p + h.yyx, anchor) - value_near(p - h.yyx, anchor)) / (2.0*h.x);
+}
+
+// The number of bisection steps taken to refine an isosurface hit between two samples
+const int ISOSURFACE_REFINE_STEPS = 5;
+
+// Refine the isovalue crossing between t0 and t1 along the ray, whose values are v0 and v1,
+// sampling within the brick of anchor where the volume isn't resident
+float refine_isosurface(vec3 ray_dir, float t0, float v0, float t1, float v1, vec3 anchor) {
+	for (int i = 0; i < ISOSURFACE_REFINE_STEPS; ++i) {
+		const float t = 0.5 * (t0 + t1);
+		const float v = value_near(transformed_eye + t * ray_dir, anchor);
+		if ((v - isovalue) * (v0 - isovalue) > 0.0) {
+			t0 = t;
+			v0 = v;
+		} else {
+			t1 = t;
+			v1 = v;
+		}
+	}
+	// Finish with the secant between the remaining bracket
+	const float d = v1 - v0;
+	return abs(d) > 1e-8 ? mix(t0, t1, clamp((isovalue - v0) / d, 0.0, 1.0)) : t1;
+}
+
+// Shade the isosurface at p with its palette's color at the isovalue and headlight diffuse lighting
+vec4 shade_isosurface(vec3 p, vec3 light_dir, float dt, uint segment_palette, vec3 anchor) {
+	const vec3 g = grad(p, dt, anchor);
+	const float diffuse = dot(g, g) > 0.0 ? abs(dot(normalize(g), light_dir)) : 1.0;
+	const vec3 base = texture(palette, vec2(isovalue, segment_palette)).rgb;
+	return vec4(base * (0.2 + 0.8 * diffuse), 1.0);
 }
 
 void main(void){
 	vec3 ray_dir = normalize(vray_dir);
 	vec3 light_dir = ray_dir;
 	vec3 inv_dir = 1.0 / ray_dir;
-	// Check for intersection against the bounding box of the volume
-	vec3 box_max = vec3(1);
-	vec3 box_min = vec3(0);
+	// Check for intersection against the bounding box of the selected segments
+	vec3 box_max = ray_box_max;
+	vec3 box_min = ray_box_min;
 	vec3 tmin_tmp = (box_min - transformed_eye) * inv_dir;
 	vec3 tmax_tmp = (box_max - transformed_eye) * inv_dir;
 	vec3 tmin = min(tmin_tmp, tmax_tmp);
@@ -62,8 +174,11 @@ void main(void){
 	float tenter = max(0, max(tmin.x, max(tmin.y, tmin.z)));
 	float texit = min(tmax.x, min(tmax.y, tmax.z));
 	const vec3 dt_vec = 1.0 / (vol_dim * abs(ray_dir));
-	const float dt = min(dt_vec.x, min(dt_vec.y, dt_vec.z));
-	tenter += dt * rand(gl_FragCoord.xy);
+	const float base_dt = min(dt_vec.x, min(dt_vec.y, dt_vec.z));
+	const float dt = base_dt * step_scale;
+	// Offset the jitter by the golden ratio each frame so the start positions of the
+	// averaged frames are well spread over the step
+	tenter += dt * fract(rand(gl_FragCoord.xy) + frame_seed * 0.61803398875);
 	if (tenter > texit){
 		discard;
 	}
@@ -73,17 +188,67 @@ void main(void){
 
 	float prev;
 	vec3 p_prev;
+	// If the previous sample was classified, in which case prev is its value
+	bool have_prev = false;
+	const ivec3 occupancy_dims = textureSize(occupancy, 0);
 	for (float t = tenter; t < texit; t += dt){
+		// Leap over macrocells with no visible data, staying on the ray's sample positions
+		const ivec3 cell = clamp(ivec3(p * vol_dim) / macrocell_size, ivec3(0), occupancy_dims - 1);
+		if (texelFetch(occupancy, cell, 0).r == 0) {
+			const vec3 cell_min = vec3(cell * macrocell_size) / vol_dim;
+			const vec3 cell_max = min(vec3((cell + 1) * macrocell_size), vol_dim) / vol_dim;
+			const vec3 cell_exit = (mix(cell_min, cell_max, greaterThan(ray_dir, vec3(0))) - transformed_eye) * inv_dir;
+			const float t_exit = min(cell_exit.x, min(cell_exit.y, cell_exit.z));
+			t = max(t + dt, tenter + ceil((t_exit - tenter) / dt) * dt) - dt;
+			p = transformed_eye + (t + dt) * ray_dir;
+			have_prev = false;
+			continue;
+		}
+
+		vec3 tex_p;
 		uint segment_palette = 0;
-		if (segment_selected(p, segment_palette)) {
-			float palette_sample = value(p);
+		if (texture_coord(p, tex_p) && segment_selected(tex_p, segment_palette)) {
+			float palette_sample = value_at(tex_p);
+			if (isosurface) {
+				// After a gap look back a step so crossings in it aren't missed, unless the
+				// volume isn't resident there, e.g. in an empty cell we just leaped over
+				float front = prev;
+				bool have_front = have_prev;
+				vec3 front_tex;
+				if (!have_prev && t > tenter && texture_coord(p - dt * ray_dir, front_tex)) {
+					front = value_at(front_tex);
+					have_front = true;
+				}
+				prev = palette_sample;
+				have_prev = true;
+				if (have_front && (front - isovalue) * (palette_sample - isovalue) <= 0.0) {
+					const float t_hit = refine_isosurface(ray_dir, t - dt, front, t, palette_sample, p);
+					color = shade_isosurface(transformed_eye + t_hit * ray_dir, light_dir, base_dt,
+							segment_palette, p);
+					break;
+				}
+				p += dt * ray_dir;
+				continue;
+			}
+#ifdef PREINTEGRATED
+			// The first sample after a gap has no segment before it so it's looked up on its own
+			const float front = have_prev ? prev : palette_sample;
+			prev = palette_sample;
+			have_prev = true;
+			vec4 color_sample = texture(preint_palette, vec3(front, palette_sample, segment_palette));
+#else
 			vec4 color_sample = texture(palette, vec2(palette_sample, segment_palette));
-			color_sample.a *= pow(dt, 0.4);
+#endif
+			color_sample.a *= pow(base_dt, 0.4);
+			// Correct the opacity for the step size so the image doesn't change as it's scaled
+			color_sample.a = 1.0 - pow(1.0 - color_sample.a, step_scale);
 			color.rgb += (1 - color.a) * color_sample.a * color_sample.rgb;
 			color.a += (1 - color.a) * color_sample.a;
 			if (color.a >= 0.97) {
 				break;
 			}
+		} else {
+			have_prev = false;
 		}
 		p += dt * ray_dir;
 	}
@@ -9,12 +9,10 @@ layout(std140, binding = 1) uniform VolProps {
 	vec2 scale_bias;
 };
 
-layout(std430, binding = 2) buffer ChosenSegmentations {
-	int num_segmentations;
-	// A segment is marked with a 1 if it's selected, 0 if not.
-	// The palette is which palette in the palette array the segment should use.
-	// the buffer is interleaved [segment selected, segment palette,...]
-	int segment_selections[];
-};
+// The box around the selected segments in the volume's [0, 1] space, which
+// is rendered and ray cast against instead of the full volume
+uniform vec3 ray_box_min;
+uniform vec3 ray_box_max;
+
 	
 
@@ -9,9 +9,10 @@ out vec3 fpos;
 flat out vec3 transformed_eye;
 
 void main(void){
-	gl_Position = proj * view * vol_transform * vec4(pos, 1);
+	const vec3 box_pos = mix(ray_box_min, ray_box_max, pos);
+	gl_Position = proj * view * vol_transform * vec4(box_pos, 1);
 	transformed_eye = (vol_inv_transform * vec4(eye_pos, 1)).xyz;
-	vray_dir = pos - transformed_eye;
+	vray_dir = box_pos - transformed_eye;
 	fpos = gl_Position.xyz;
 }
 
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vtkType.h>
+#include "parallel.h"
+#include "segment_stats.h"
+
+// Number of voxels each parallel task processes, rounded to whole rows of the volume
+static const size_t TASK_SIZE = 1 << 20;
+
+size_t SegmentStats::size() const {
+	return count.size();
+}
+bool SegmentStats::empty(const size_t segment) const {
+	return segment >= count.size() || count[segment] == 0;
+}
+double SegmentStats::mean(const size_t segment) const {
+	return empty(segment) ? 0.0 : value_sum[segment] / count[segment];
+}
+void SegmentStats::clear() {
+	resize(0);
+}
+void SegmentStats::resize(const size_t num_segments) {
+	count.assign(num_segments, 0);
+	value_min.assign(num_segments, std::numeric_limits<float>::max());
+	value_max.assign(num_segments, std::numeric_limits<float>::lowest());
+	value_sum.assign(num_segments, 0.0);
+	for (size_t i = 0; i < 3; ++i) {
+		bbox_min[i].assign(num_segments, std::numeric_limits<int>::max());
+		bbox_max[i].assign(num_segments, std::numeric_limits<int>::lowest());
+	}
+}
+
+template<typename T, typename S>
+static void stats_kernel(const T *data, const S *seg, const std::array<int, 3> &dims, SegmentStats &out) {
+	const size_t num_segments = out.size();
+	const size_t row_len = dims[0];
+	const size_t num_rows = static_cast<size_t>(dims[1]) * dims[2];
+	const size_t rows_per_task = std::max(size_t{1}, TASK_SIZE / row_len);
+
+	// Each thread accumulates into its own table, which are merged after the sweep
+	std::vector<SegmentStats> thread_stats(get_num_threads());
+	parallel_for(0, num_rows, rows_per_task, [&](const size_t begin, const size_t end, const size_t thread_id) {
+		SegmentStats &stats = thread_stats[thread_id];
+		if (stats.size() != num_segments) {
+			stats.resize(num_segments);
+		}
+		for (size_t r = begin; r < end; ++r) {
+			const int y = r % dims[1];
+			const int z = r / dims[1];
+			const T *data_row = data + r * row_len;
+			const S *seg_row = seg + r * row_len;
+			for (size_t x = 0; x < row_len; ++x) {
+				const int64_t s = static_cast<int64_t>(seg_row[x]);
+				if (s < 0 || static_cast<size_t>(s) >= num_segments) {
+					continue;
+				}
+				const float v = static_cast<float>(data_row[x]);
+				++stats.count[s];
+				stats.value_min[s] = std::min(stats.value_min[s], v);
+				stats.value_max[s] = std::max(stats.value_max[s], v);
+				stats.value_sum[s] += v;
+				stats.bbox_min[0][s] = std::min(stats.bbox_min[0][s], static_cast<int>(x));
+				stats.bbox_max[0][s] = std::max(stats.bbox_max[0][s], static_cast<int>(x));
+				stats.bbox_min[1][s] = std::min(stats.bbox_min[1][s], y);
+				stats.bbox_max[1][s] = std::max(stats.bbox_max[1][s], y);
+				stats.bbox_min[2][s] = std::min(stats.bbox_min[2][s], z);
+				stats.bbox_max[2][s] = std::max(stats.bbox_max[2][s], z);
+			}
+		}
+	});
+
+	// Merge the thread tables, in parallel over the segments
+	parallel_for(0, num_segments, 1 << 12, [&](const size_t begin, const size_t end, const size_t) {
+		for (const auto &stats : thread_stats) {
+			if (stats.size() != num_segments) {
+				continue;
+			}
+			for (size_t s = begin; s < end; ++s) {
+				out.count[s] += stats.count[s];
+				out.value_min[s] = std::min(out.value_min[s], stats.value_min[s]);
+				out.value_max[s] = std::max(out.value_max[s], stats.value_max[s]);
+				out.value_sum[s] += stats.value_sum[s];
+				for (size_t i = 0; i < 3; ++i) {
+					out.bbox_min[i][s] = std::min(out.bbox_min[i][s], stats.bbox_min[i][s]);
+					out.bbox_max[i][s] = std::max(out.bbox_max[i][s], stats.bbox_max[i][s]);
+				}
+			}
+		}
+	});
+}
+template<typename T>
+static void dispatch_segmentation(const T *data, vtkDataArray *segmentation, const std::array<int, 3> &dims,
+		SegmentStats &out)
+{
+	void *ptr = segmentation->GetVoidPointer(0);
+	switch (segmentation->GetDataType()) {
+		vtkTemplateMacro(stats_kernel(data, static_cast<const VTK_TT*>(ptr), dims, out));
+		default:
+			throw std::runtime_error("Unsupported segmentation data type '"
+					+ std::to_string(segmentation->GetDataType()) + "'");
+	}
+}
+
+void build_segment_stats(vtkDataArray *data, vtkDataArray *segmentation,
+		const std::array<int, 3> &dims, SegmentStats &out)
+{
+	const size_t num_voxels = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+	if (static_cast<size_t>(data->GetNumberOfTuples()) != num_voxels
+			|| static_cast<size_t>(segmentation->GetNumberOfTuples()) != num_voxels)
+	{
+		throw std::runtime_error("Segmentation and volume sizes don't match the dimensions");
+	}
+	out.resize(static_cast<size_t>(segmentation->GetRange()[1]) + 1);
+
+	void *ptr = data->GetVoidPointer(0);
+	switch (data->GetDataType()) {
+		vtkTemplateMacro(dispatch_segmentation(static_cast<const VTK_TT*>(ptr), segmentation, dims, out));
+		default:
+			throw std::runtime_error("Unsupported volume data type '"
+					+ std::to_string(data->GetDataType()) + "'");
+	}
+}
+
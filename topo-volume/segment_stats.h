@@ -0,0 +1,33 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <vtkDataArray.h>
+
+/* Statistics of the voxels in each segment of the segmentation, stored as
+ * a structure of arrays indexed by the segment id. Segments which don't
+ * have any voxels have a count of 0 and an empty bounding box.
+ */
+struct SegmentStats {
+	std::vector<uint64_t> count;
+	std::vector<float> value_min, value_max;
+	std::vector<double> value_sum;
+	// Inclusive voxel bounding box of the segment, stored as one array per axis
+	std::array<std::vector<int>, 3> bbox_min, bbox_max;
+
+	size_t size() const;
+	bool empty(const size_t segment) const;
+	double mean(const size_t segment) const;
+	void clear();
+	void resize(const size_t num_segments);
+};
+
+/* Compute the statistics of each segment in one parallel pass over the volume,
+ * the segment ids are read from the segmentation array which must have the same
+ * dimensions as the data. Supports all of VTK's scalar types for the data and ids.
+ */
+void build_segment_stats(vtkDataArray *data, vtkDataArray *segmentation,
+		const std::array<int, 3> &dims, SegmentStats &out);
+
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include "glt/gl_core_4_5.h"
+
+// The GL format a volume is uploaded with
+struct TextureFormat {
+	GLenum internal_format, type, pixel_format;
+	size_t bytes_per_voxel;
+};
+
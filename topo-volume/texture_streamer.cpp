@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cstring>
+#include "parallel.h"
+#include "texture_streamer.h"
+
+TextureStreamer::TextureStreamer(const size_t region_size)
+	: pbo(0), region_size(region_size), mapping(nullptr), next_region(0), total_bytes(0), uploaded_bytes(0)
+{
+	fences.fill(nullptr);
+}
+TextureStreamer::~TextureStreamer() {
+	for (auto &f : fences) {
+		if (f) {
+			glDeleteSync(f);
+		}
+	}
+	if (pbo != 0) {
+		if (mapping) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &pbo);
+	}
+}
+void TextureStreamer::upload(GLuint texture, const TextureFormat &format, const std::array<int, 3> &offset,
+		const std::array<int, 3> &size, const void *src, const std::array<int, 3> &src_dims)
+{
+	if (size[0] <= 0 || size[1] <= 0 || size[2] <= 0) {
+		return;
+	}
+	uploads.push_back(Upload{texture, format, offset, size, src_dims, static_cast<const uint8_t*>(src), 0});
+	total_bytes += static_cast<size_t>(size[0]) * size[1] * size[2] * format.bytes_per_voxel;
+}
+void TextureStreamer::cancel(GLuint texture) {
+	uploads.erase(std::remove_if(uploads.begin(), uploads.end(),
+				[&](const Upload &u) { return u.texture == texture; }),
+			uploads.end());
+	if (uploads.empty()) {
+		total_bytes = 0;
+		uploaded_bytes = 0;
+	}
+}
+bool TextureStreamer::pending(GLuint texture) const {
+	return std::any_of(uploads.begin(), uploads.end(), [&](const Upload &u) { return u.texture == texture; });
+}
+void TextureStreamer::process(const size_t byte_budget) {
+	if (uploads.empty()) {
+		return;
+	}
+	size_t max_slice_bytes = 0;
+	for (const auto &u : uploads) {
+		max_slice_bytes = std::max(max_slice_bytes,
+				static_cast<size_t>(u.size[0]) * u.size[1] * u.format.bytes_per_voxel);
+	}
+	if (pbo == 0 || max_slice_bytes > region_size) {
+		allocate(max_slice_bytes);
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+	size_t sent = 0;
+	while (!uploads.empty() && (sent == 0 || sent < byte_budget) && region_free(next_region)) {
+		Upload &u = uploads.front();
+		const size_t row_bytes = static_cast<size_t>(u.size[0]) * u.format.bytes_per_voxel;
+		const size_t slice_bytes = row_bytes * u.size[1];
+		// Fill the region with as many slices as fit in it and the remaining budget,
+		// but always send at least one
+		const size_t budget_slices = sent < byte_budget ? (byte_budget - sent) / slice_bytes : 0;
+		const int num_slices = static_cast<int>(std::max(size_t{1}, std::min({region_size / slice_bytes,
+						budget_slices, static_cast<size_t>(u.size[2] - u.next_slice)})));
+		const size_t slab_bytes = slice_bytes * num_slices;
+
+		const size_t region_offset = next_region * region_size;
+		uint8_t *dst = mapping ? mapping + region_offset
+			: static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, region_offset, slab_bytes,
+						GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+		const size_t num_rows = static_cast<size_t>(u.size[1]) * num_slices;
+		parallel_for(0, num_rows, 256, [&](const size_t begin, const size_t end, const size_t) {
+			for (size_t r = begin; r < end; ++r) {
+				const size_t z = u.offset[2] + u.next_slice + r / u.size[1];
+				const size_t y = u.offset[1] + r % u.size[1];
+				const size_t src_row = (z * u.src_dims[1] + y) * u.src_dims[0] + u.offset[0];
+				std::memcpy(dst + r * row_bytes, u.src + src_row * u.format.bytes_per_voxel, row_bytes);
+			}
+		});
+		if (!mapping) {
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+
+		glBindTexture(GL_TEXTURE_3D, u.texture);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, u.offset[0], u.offset[1], u.offset[2] + u.next_slice,
+				u.size[0], u.size[1], num_slices, u.format.pixel_format, u.format.type,
+				reinterpret_cast<const void*>(region_offset));
+		fences[next_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		next_region = (next_region + 1) % NUM_REGIONS;
+
+		sent += slab_bytes;
+		uploaded_bytes += slab_bytes;
+		u.next_slice += num_slices;
+		if (u.next_slice >= u.size[2]) {
+			uploads.pop_front();
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (uploads.empty()) {
+		total_bytes = 0;
+		uploaded_bytes = 0;
+	}
+}
+bool TextureStreamer::busy() const {
+	return !uploads.empty();
+}
+float TextureStreamer::progress() const {
+	return total_bytes == 0 ? 1.f : static_cast<float>(uploaded_bytes) / total_bytes;
+}
+void TextureStreamer::allocate(const size_t min_region_size) {
+	// The old regions may still be read by uploads in flight
+	for (auto &f : fences) {
+		if (f) {
+			glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(f);
+			f = nullptr;
+		}
+	}
+	if (pbo != 0) {
+		if (mapping) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			mapping = nullptr;
+		}
+		glDeleteBuffers(1, &pbo);
+	}
+	region_size = std::max(region_size, min_region_size);
+	next_region = 0;
+
+	glGenBuffers(1, &pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	const size_t size = region_size * NUM_REGIONS;
+	if (ogl_IsVersionGEQ(4, 4)) {
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+		mapping = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+	} else {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+bool TextureStreamer::region_free(const size_t region) {
+	if (!fences[region]) {
+		return true;
+	}
+	const GLenum status = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if (status == GL_TIMEOUT_EXPIRED) {
+		return false;
+	}
+	glDeleteSync(fences[region]);
+	fences[region] = nullptr;
+	return true;
+}
+
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <cstdint>
+#include <cstddef>
+#include "glt/gl_core_4_5.h"
+#include "texture_format.h"
+
+/* Streams data into 3D textures over several frames through a ring of pixel
+ * buffer regions. Uploads are split into slabs of z slices which are copied into
+ * a free region and uploaded from it, a fence is placed after each upload so the
+ * region is only reused once the GPU is done reading it. The buffer is persistently
+ * mapped on GL 4.4, otherwise each region is mapped unsynchronized when written.
+ */
+class TextureStreamer {
+public:
+	static const size_t NUM_REGIONS = 3;
+
+private:
+	// A box of a texture to upload from the source volume, which must stay alive until it's done
+	struct Upload {
+		GLuint texture;
+		TextureFormat format;
+		std::array<int, 3> offset, size, src_dims;
+		const uint8_t *src;
+		// The next z slice of the box to upload
+		int next_slice;
+	};
+
+	GLuint pbo;
+	size_t region_size;
+	uint8_t *mapping;
+	std::array<GLsync, NUM_REGIONS> fences;
+	size_t next_region;
+	std::deque<Upload> uploads;
+	// The bytes queued and uploaded since we were last idle, for reporting progress
+	size_t total_bytes, uploaded_bytes;
+
+public:
+	// The region size is a minimum, regions are grown to hold at least one slice of any upload
+	TextureStreamer(const size_t region_size = 32 * 1024 * 1024);
+	~TextureStreamer();
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+	/* Queue an upload of the box at offset of the given size from the source volume
+	 * with dims src_dims into the texture, whose storage must already be allocated.
+	 * The box is at the same offset in the source and the texture
+	 */
+	void upload(GLuint texture, const TextureFormat &format, const std::array<int, 3> &offset,
+			const std::array<int, 3> &size, const void *src, const std::array<int, 3> &src_dims);
+	// Drop any queued uploads to the texture, e.g. if its data changed or is being re-allocated
+	void cancel(GLuint texture);
+	// Check if there are uploads queued for the texture
+	bool pending(GLuint texture) const;
+	/* Upload slabs until byte_budget bytes have been sent or no free region is available,
+	 * at least one slice is uploaded per call if possible so large slices still make progress.
+	 * Changes the GL_TEXTURE_3D binding on the active texture unit
+	 */
+	void process(const size_t byte_budget);
+	bool busy() const;
+	// Fraction of the queued bytes uploaded so far
+	float progress() const;
+
+private:
+	// Allocate the pixel buffer to fit regions of at least the size passed, waiting for any in flight uploads
+	void allocate(const size_t min_region_size);
+	// Check if the region's previous upload is done without blocking
+	bool region_free(const size_t region);
+};
+
@@ -0,0 +1,363 @@
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#include <vtkDataArray.h>
+#include <vtkIntArray.h>
+#include <vtkPointData.h>
+#include <vtkXMLUnstructuredGridReader.h>
+#include <vtkXMLUnstructuredGridWriter.h>
+#include "parallel.h"
+#include "raw_volume.h"
+#include "topology_cache.h"
+
+// Blocks of the volume are hashed independently, the block size is fixed so the
+// hash is the same no matter how many threads we have
+static const size_t HASH_BLOCK_SIZE = 16 * 1024 * 1024;
+static const uint64_t PRIME1 = 0x9e3779b185ebca87ULL;
+static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4fULL;
+
+static inline uint64_t rotl(const uint64_t x, const int r) {
+	return (x << r) | (x >> (64 - r));
+}
+static inline uint64_t mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+// Hash a block with four independent lanes so the loop isn't bound by the multiply latency
+static uint64_t hash_block(const char *data, const size_t size) {
+	std::array<uint64_t, 4> lanes = {PRIME1 + PRIME2, PRIME2, 0, PRIME1};
+	const size_t num_words = size / 8;
+	size_t i = 0;
+	for (; i + 4 <= num_words; i += 4) {
+		for (size_t l = 0; l < 4; ++l) {
+			uint64_t w;
+			std::memcpy(&w, data + (i + l) * 8, 8);
+			lanes[l] = rotl(lanes[l] + w * PRIME2, 31) * PRIME1;
+		}
+	}
+	uint64_t h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+	for (; i < num_words; ++i) {
+		uint64_t w;
+		std::memcpy(&w, data + i * 8, 8);
+		h = rotl(h ^ (w * PRIME2), 27) * PRIME1;
+	}
+	for (size_t b = num_words * 8; b < size; ++b) {
+		h = rotl(h ^ (static_cast<uint8_t>(data[b]) * PRIME1), 11) * PRIME2;
+	}
+	return mix(h ^ size);
+}
+uint64_t hash_volume(vtkImageData *volume) {
+	vtkDataArray *data = volume->GetPointData()->GetScalars();
+	if (!data) {
+		throw std::runtime_error("Can't hash a volume without scalar data");
+	}
+	const char *bytes = static_cast<const char*>(data->GetVoidPointer(0));
+	const size_t size = data->GetNumberOfTuples() * data->GetNumberOfComponents()
+		* data->GetDataTypeSize();
+	const size_t num_blocks = (size + HASH_BLOCK_SIZE - 1) / HASH_BLOCK_SIZE;
+	std::vector<uint64_t> block_hashes(num_blocks, 0);
+	parallel_for(0, num_blocks, 1, [&](const size_t begin, const size_t end, const size_t) {
+		for (size_t b = begin; b < end; ++b) {
+			const size_t offset = b * HASH_BLOCK_SIZE;
+			block_hashes[b] = hash_block(bytes + offset, std::min(HASH_BLOCK_SIZE, size - offset));
+		}
+	});
+
+	uint64_t h = mix(static_cast<uint64_t>(data->GetDataType()));
+	for (size_t i = 0; i < 3; ++i) {
+		h = mix(h ^ static_cast<uint64_t>(volume->GetDimensions()[i]) * PRIME1);
+	}
+	for (const auto &b : block_hashes) {
+		h = mix(rotl(h, 17) ^ b);
+	}
+	return h;
+}
+
+static void make_dir(const std::string &dir) {
+#ifdef _WIN32
+	_mkdir(dir.c_str());
+#else
+	mkdir(dir.c_str(), 0755);
+#endif
+}
+static bool file_exists(const std::string &fname) {
+	std::ifstream f(fname.c_str(), std::ios::binary);
+	return f.good();
+}
+/* Write to a temporary file and rename it in so other instances never see partial files.
+ * The temporary name is unique to the process and write so concurrent stores of the
+ * same file don't write over each other's temporary
+ */
+static std::string temp_path(const std::string &fname) {
+	static std::atomic<unsigned int> next_id(0);
+#ifdef _WIN32
+	const int pid = _getpid();
+#else
+	const int pid = static_cast<int>(getpid());
+#endif
+	return fname + "." + std::to_string(pid) + "_" + std::to_string(next_id++) + ".tmp";
+}
+static void commit_file(const std::string &tmp, const std::string &fname) {
+#ifdef _WIN32
+	// rename won't replace an existing file on Windows
+	std::remove(fname.c_str());
+#endif
+	if (std::rename(tmp.c_str(), fname.c_str()) != 0) {
+		std::remove(tmp.c_str());
+		std::cerr << "TopologyCache: failed to write " << fname << "\n";
+	}
+}
+// Close the stream written to tmp and commit it, or remove tmp if the write failed
+static void finish_write(std::ofstream &out, const std::string &tmp, const std::string &fname) {
+	out.close();
+	if (!out) {
+		std::remove(tmp.c_str());
+		std::cerr << "TopologyCache: failed to write " << fname << "\n";
+		return;
+	}
+	commit_file(tmp, fname);
+}
+static vtkSmartPointer<vtkUnstructuredGrid> read_grid(const std::string &fname) {
+	if (!file_exists(fname)) {
+		return nullptr;
+	}
+	vtkSmartPointer<vtkXMLUnstructuredGridReader> reader
+		= vtkSmartPointer<vtkXMLUnstructuredGridReader>::New();
+	reader->SetFileName(fname.c_str());
+	reader->Update();
+	return reader->GetOutput();
+}
+static void write_grid(const std::string &fname, vtkUnstructuredGrid *grid) {
+	vtkSmartPointer<vtkXMLUnstructuredGridWriter> writer
+		= vtkSmartPointer<vtkXMLUnstructuredGridWriter>::New();
+	const std::string tmp = temp_path(fname);
+	writer->SetFileName(tmp.c_str());
+	writer->SetInputData(grid);
+	// Store the arrays uncompressed and unencoded so reading them back is just a copy
+	writer->SetDataModeToAppended();
+	writer->EncodeAppendedDataOff();
+	writer->SetCompressorTypeToNone();
+	if (writer->Write() == 1) {
+		commit_file(tmp, fname);
+	} else {
+		std::remove(tmp.c_str());
+	}
+}
+/* Tables are written as a list of columns, each column is:
+ * [name length (u32), name, vtk type (i32), tuples (u64), components (i32), data]
+ */
+static void write_table(std::ofstream &out, vtkTable *table) {
+	const uint32_t num_cols = table->GetNumberOfColumns();
+	out.write(reinterpret_cast<const char*>(&num_cols), sizeof(num_cols));
+	for (uint32_t i = 0; i < num_cols; ++i) {
+		vtkDataArray *col = vtkDataArray::SafeDownCast(table->GetColumn(i));
+		if (!col) {
+			throw std::runtime_error("TopologyCache: can only cache numeric table columns");
+		}
+		const std::string name = col->GetName() ? col->GetName() : "";
+		const uint32_t name_len = name.size();
+		const int32_t type = col->GetDataType();
+		const uint64_t tuples = col->GetNumberOfTuples();
+		const int32_t comps = col->GetNumberOfComponents();
+		out.write(reinterpret_cast<const char*>(&name_len), sizeof(name_len));
+		out.write(name.data(), name_len);
+		out.write(reinterpret_cast<const char*>(&type), sizeof(type));
+		out.write(reinterpret_cast<const char*>(&tuples), sizeof(tuples));
+		out.write(reinterpret_cast<const char*>(&comps), sizeof(comps));
+		out.write(static_cast<const char*>(col->GetVoidPointer(0)),
+				tuples * comps * col->GetDataTypeSize());
+	}
+}
+/* Read a table written by write_table from a file of file_size bytes. Returns null if
+ * the table is truncated or its header is invalid, the header is checked against the
+ * bytes left in the file before allocating anything so corrupt files can't make us
+ * allocate huge columns
+ */
+static vtkSmartPointer<vtkTable> read_table(std::ifstream &in, const uint64_t file_size) {
+	auto bytes_left = [&]() {
+		const std::streamoff pos = in.tellg();
+		return pos < 0 ? uint64_t{0} : file_size - std::min(static_cast<uint64_t>(pos), file_size);
+	};
+	vtkSmartPointer<vtkTable> table = vtkSmartPointer<vtkTable>::New();
+	uint32_t num_cols = 0;
+	in.read(reinterpret_cast<char*>(&num_cols), sizeof(num_cols));
+	for (uint32_t i = 0; i < num_cols && in; ++i) {
+		uint32_t name_len = 0;
+		int32_t type = 0, comps = 0;
+		uint64_t tuples = 0;
+		in.read(reinterpret_cast<char*>(&name_len), sizeof(name_len));
+		if (!in || name_len > bytes_left()) {
+			return nullptr;
+		}
+		std::string name(name_len, '\0');
+		in.read(&name[0], name_len);
+		in.read(reinterpret_cast<char*>(&type), sizeof(type));
+		in.read(reinterpret_cast<char*>(&tuples), sizeof(tuples));
+		in.read(reinterpret_cast<char*>(&comps), sizeof(comps));
+		if (!in || comps <= 0) {
+			return nullptr;
+		}
+		const uint64_t elem_size = vtkDataArray::GetDataTypeSize(type);
+		if (elem_size == 0 || tuples > bytes_left() / (elem_size * comps)) {
+			return nullptr;
+		}
+
+		vtkSmartPointer<vtkDataArray> col = vtkSmartPointer<vtkDataArray>::Take(
+				vtkDataArray::CreateDataArray(type));
+		if (!col) {
+			return nullptr;
+		}
+		col->SetName(name.c_str());
+		col->SetNumberOfComponents(comps);
+		col->SetNumberOfTuples(tuples);
+		in.read(static_cast<char*>(col->GetVoidPointer(0)), tuples * comps * col->GetDataTypeSize());
+		table->AddColumn(col);
+	}
+	if (!in) {
+		return nullptr;
+	}
+	return table;
+}
+
+TopologyCache::TopologyCache(const std::string &dir, vtkImageData *volume)
+	: cache_dir(dir), volume(volume), volume_hash(hash_volume(volume)), threshold(0.f)
+{
+	if (!cache_dir.empty() && cache_dir.back() != '/') {
+		cache_dir += '/';
+	}
+	make_dir(cache_dir);
+}
+uint64_t TopologyCache::get_volume_hash() const {
+	return volume_hash;
+}
+void TopologyCache::set_threshold(const float t) {
+	threshold = t;
+}
+vtkSmartPointer<vtkUnstructuredGrid> TopologyCache::load_diagram() const {
+	return read_grid(file_path("diagram.vtu"));
+}
+void TopologyCache::store_diagram(vtkUnstructuredGrid *diagram) const {
+	write_grid(file_path("diagram.vtu"), diagram);
+}
+bool TopologyCache::load_curves(std::array<vtkSmartPointer<vtkTable>, 4> &curves) const {
+	std::ifstream in(file_path("curves.bin").c_str(), std::ios::binary | std::ios::ate);
+	if (!in) {
+		return false;
+	}
+	const std::streamoff file_size = in.tellg();
+	in.seekg(0);
+	if (file_size < 0 || !in) {
+		return false;
+	}
+	std::array<vtkSmartPointer<vtkTable>, 4> loaded;
+	for (auto &t : loaded) {
+		t = read_table(in, static_cast<uint64_t>(file_size));
+		if (!t) {
+			return false;
+		}
+	}
+	curves = loaded;
+	return true;
+}
+void TopologyCache::store_curves(const std::array<vtkSmartPointer<vtkTable>, 4> &curves) const {
+	const std::string fname = file_path("curves.bin");
+	const std::string tmp = temp_path(fname);
+	std::ofstream out(tmp.c_str(), std::ios::binary);
+	for (const auto &t : curves) {
+		write_table(out, t.Get());
+	}
+	finish_write(out, tmp, fname);
+}
+bool TopologyCache::has_tree(const int tree_type) const {
+	return file_exists(tree_file_path(tree_type, "seg.raw"));
+}
+bool TopologyCache::load_tree(const int tree_type, vtkUnstructuredGrid *nodes,
+		vtkUnstructuredGrid *arcs, vtkImageData *segmentation) const
+{
+	if (!has_tree(tree_type)) {
+		return false;
+	}
+	vtkSmartPointer<vtkUnstructuredGrid> cached_nodes = read_grid(tree_file_path(tree_type, "nodes.vtu"));
+	vtkSmartPointer<vtkUnstructuredGrid> cached_arcs = read_grid(tree_file_path(tree_type, "arcs.vtu"));
+	if (!cached_nodes || !cached_arcs) {
+		return false;
+	}
+	std::array<int, 3> dims;
+	for (size_t i = 0; i < 3; ++i) {
+		dims[i] = volume->GetDimensions()[i];
+	}
+	vtkSmartPointer<vtkImageData> seg_vol = map_raw_volume(tree_file_path(tree_type, "seg.raw"), dims, VTK_INT);
+	if (!seg_vol) {
+		return false;
+	}
+	vtkDataArray *seg_ids = seg_vol->GetPointData()->GetScalars();
+	seg_ids->SetName("SegmentationId");
+
+	nodes->ShallowCopy(cached_nodes);
+	arcs->ShallowCopy(cached_arcs);
+	segmentation->Initialize();
+	segmentation->CopyStructure(volume);
+	segmentation->GetPointData()->AddArray(seg_ids);
+	segmentation->Modified();
+	return true;
+}
+void TopologyCache::store_tree(const int tree_type, vtkUnstructuredGrid *nodes,
+		vtkUnstructuredGrid *arcs, vtkImageData *segmentation) const
+{
+	vtkDataArray *seg_ids = segmentation->GetPointData()->GetArray("SegmentationId");
+	if (!seg_ids) {
+		return;
+	}
+	// The segmentation is always stored as int so we know how to map it back in
+	vtkSmartPointer<vtkIntArray> int_ids = vtkIntArray::SafeDownCast(seg_ids);
+	if (!int_ids) {
+		int_ids = vtkSmartPointer<vtkIntArray>::New();
+		int_ids->DeepCopy(seg_ids);
+	}
+	write_grid(tree_file_path(tree_type, "nodes.vtu"), nodes);
+	write_grid(tree_file_path(tree_type, "arcs.vtu"), arcs);
+
+	// The segmentation is written last since it marks the tree as being cached
+	const std::string fname = tree_file_path(tree_type, "seg.raw");
+	const std::string tmp = temp_path(fname);
+	std::ofstream out(tmp.c_str(), std::ios::binary);
+	out.write(reinterpret_cast<const char*>(int_ids->GetPointer(0)),
+			int_ids->GetNumberOfTuples() * sizeof(int));
+	finish_write(out, tmp, fname);
+}
+std::string TopologyCache::file_path(const std::string &name) const {
+	std::stringstream ss;
+	ss << cache_dir << std::hex << std::setw(16) << std::setfill('0') << volume_hash << "_" << name;
+	return ss.str();
+}
+std::string TopologyCache::tree_file_path(const int tree_type, const std::string &name) const {
+	// Use the bits of the threshold so we only match the exact same threshold
+	uint32_t threshold_bits = 0;
+	std::memcpy(&threshold_bits, &threshold, sizeof(float));
+	std::stringstream ss;
+	ss << "tree" << tree_type << "_" << std::hex << std::setw(8) << std::setfill('0')
+		<< threshold_bits << "_" << name;
+	return file_path(ss.str());
+}
+
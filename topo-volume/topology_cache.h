@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <vtkSmartPointer.h>
+#include <vtkImageData.h>
+#include <vtkTable.h>
+#include <vtkUnstructuredGrid.h>
+
+/* Compute a 64-bit hash of the volume's scalar data, dimensions and type.
+ * The data is hashed in fixed size blocks in parallel and the block hashes
+ * combined in order, so the result doesn't depend on the number of threads.
+ */
+uint64_t hash_volume(vtkImageData *volume);
+
+/* On-disk cache of the topological structures computed for a volume, keyed by
+ * a hash of the volume's contents. The persistence diagram and curves depend
+ * only on the volume, while the tree nodes, arcs and segmentation also depend on
+ * the simplification threshold and the tree type. The segmentation is stored as
+ * a raw array which is memory mapped back in when loaded, so a warm start
+ * doesn't need to run TTK at all.
+ */
+class TopologyCache {
+	std::string cache_dir;
+	vtkImageData *volume;
+	uint64_t volume_hash;
+	// The simplification threshold the tree entries are looked up for
+	float threshold;
+
+public:
+	TopologyCache(const std::string &cache_dir, vtkImageData *volume);
+	uint64_t get_volume_hash() const;
+	// Set the persistence threshold used to simplify the data before computing the tree
+	void set_threshold(const float threshold);
+	// Load the persistence diagram, returns null if it's not cached
+	vtkSmartPointer<vtkUnstructuredGrid> load_diagram() const;
+	void store_diagram(vtkUnstructuredGrid *diagram) const;
+	// Load the persistence curve tables for each tree type output by ttkPersistenceCurve
+	bool load_curves(std::array<vtkSmartPointer<vtkTable>, 4> &curves) const;
+	void store_curves(const std::array<vtkSmartPointer<vtkTable>, 4> &curves) const;
+	// Check if the tree of the type is cached for the current threshold
+	bool has_tree(const int tree_type) const;
+	/* Load the tree of the type computed at the current threshold into the passed
+	 * outputs of ttkFTMTree. The segmentation gets the volume's structure and the
+	 * cached SegmentationId array. Returns false if the tree isn't cached
+	 */
+	bool load_tree(const int tree_type, vtkUnstructuredGrid *nodes, vtkUnstructuredGrid *arcs,
+			vtkImageData *segmentation) const;
+	void store_tree(const int tree_type, vtkUnstructuredGrid *nodes, vtkUnstructuredGrid *arcs,
+			vtkImageData *segmentation) const;
+
+private:
+	std::string file_path(const std::string &name) const;
+	std::string tree_file_path(const int tree_type, const std::string &name) const;
+};
+
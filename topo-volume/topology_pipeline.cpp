@@ -0,0 +1,130 @@
+#include <thread>
+#include <vtkDataObject.h>
+#include <vtkInformation.h>
+#include "topology_pipeline.h"
+
+TopologyPipeline::TopologyPipeline(vtkImageData *data, unsigned int debug, TopologyCache *cache,
+		int threads, PipelineProfiler *profiler)
+	: data(data), cache(cache), profiler(profiler), debuglevel(debug),
+	num_threads(threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency()))
+{
+	diagram = vtkSmartPointer<ttkPersistenceDiagram>::New();
+	diagram->SetdebugLevel_(debuglevel);
+	diagram->SetUseAllCores(false);
+	diagram->SetThreadNumber(num_threads);
+	diagram->SetInputData(data);
+
+	critical_pairs = vtkSmartPointer<vtkThreshold>::New();
+	critical_pairs->SetInputArrayToProcess(0, 0, 0, vtkDataObject::FIELD_ASSOCIATION_CELLS, "PairIdentifier");
+	critical_pairs->ThresholdBetween(-0.1, 999999);
+
+	// Select the most persistent pairs
+	persistent_pairs = vtkSmartPointer<vtkThreshold>::New();
+	persistent_pairs->SetInputConnection(critical_pairs->GetOutputPort());
+	persistent_pairs->SetInputArrayToProcess(0, 0, 0, vtkDataObject::FIELD_ASSOCIATION_CELLS, "Persistence");
+
+	// Simplifying the input data to remove non-persistent pairs
+	simplification = vtkSmartPointer<ttkTopologicalSimplification>::New();
+	simplification->SetdebugLevel_(debuglevel);
+	simplification->SetUseAllCores(false);
+	simplification->SetThreadNumber(num_threads);
+	simplification->SetInputData(0, data);
+	simplification->SetInputConnection(1, persistent_pairs->GetOutputPort());
+
+	vtkcurve = vtkSmartPointer<ttkPersistenceCurve>::New();
+	vtkcurve->SetdebugLevel_(debuglevel);
+	vtkcurve->SetInputData(data);
+	vtkcurve->SetComputeSaddleConnectors(false);
+	vtkcurve->SetUseAllCores(false);
+	vtkcurve->SetThreadNumber(num_threads);
+
+	if (profiler) {
+		profiler->watch(diagram, "PersistenceDiagram", num_threads);
+		profiler->watch(critical_pairs, "CriticalPairsThreshold", 1);
+		profiler->watch(persistent_pairs, "PersistentPairsThreshold", 1);
+		profiler->watch(simplification, "TopologicalSimplification", num_threads);
+		profiler->watch(vtkcurve, "PersistenceCurve", num_threads);
+	}
+}
+void TopologyPipeline::compute_diagram() {
+	if (cache) {
+		diagram_output = cache->load_diagram();
+	}
+	if (diagram_output) {
+		critical_pairs->SetInputData(diagram_output);
+	} else {
+		diagram->Update();
+		diagram_output = vtkUnstructuredGrid::SafeDownCast(diagram->GetOutput());
+		critical_pairs->SetInputConnection(diagram->GetOutputPort());
+		if (cache) {
+			cache->store_diagram(diagram_output);
+		}
+	}
+}
+void TopologyPipeline::compute_curves() {
+	if (cache && cache->load_curves(curve_tables)) {
+		return;
+	}
+	vtkcurve->Update();
+	for (size_t i = 0; i < curve_tables.size(); ++i) {
+		curve_tables[i] = vtkTable::SafeDownCast(vtkcurve->GetOutputInformation(i)->Get(vtkDataObject::DATA_OBJECT()));
+	}
+	if (cache) {
+		cache->store_curves(curve_tables);
+	}
+}
+vtkUnstructuredGrid* TopologyPipeline::get_diagram() const {
+	return diagram_output.Get();
+}
+vtkTable* TopologyPipeline::get_curve(const ttk::ftm::TreeType &tree_type) const {
+	// The persistence curve outputs are the join tree, the Morse-Smale curve,
+	// the split tree and the contour tree
+	switch (tree_type) {
+		case ttk::ftm::TreeType::Contour: return curve_tables[3].Get();
+		case ttk::ftm::TreeType::Split: return curve_tables[2].Get();
+		case ttk::ftm::TreeType::Join: return curve_tables[0].Get();
+		default: return curve_tables[0].Get();
+	}
+}
+ttkTopologicalSimplification* TopologyPipeline::get_simplification() const {
+	return simplification.Get();
+}
+void TopologyPipeline::simplify(const float lo, const float hi, const ttk::ftm::TreeType &tree_type) {
+	persistent_pairs->ThresholdBetween(lo, hi);
+	if (cache) {
+		cache->set_threshold(lo);
+		if (cache->has_tree(static_cast<int>(tree_type))) {
+			simplification->InvokeEvent(vtkCommand::EndEvent);
+			return;
+		}
+	}
+	simplification->Update();
+}
+vtkSmartPointer<ttkFTMTree> TopologyPipeline::create_tree() const {
+	vtkSmartPointer<ttkFTMTree> contour_forest = vtkSmartPointer<ttkFTMTree>::New();
+	contour_forest->SetInputConnection(simplification->GetOutputPort());
+	contour_forest->SetSuperArcSamplingLevel(10);
+	contour_forest->SetUseAllCores(false);
+	contour_forest->SetThreadNumber(num_threads);
+	contour_forest->SetdebugLevel_(debuglevel);
+	contour_forest->SetWithSegmentation(true);
+	if (profiler) {
+		profiler->watch(contour_forest, "FTMTree", num_threads);
+	}
+	return contour_forest;
+}
+
+void update_tree(ttkFTMTree *contour_forest, const int tree_type, TopologyCache *cache) {
+	contour_forest->SetTreeType(tree_type);
+	vtkUnstructuredGrid *nodes_out = vtkUnstructuredGrid::SafeDownCast(contour_forest->GetOutput(0));
+	vtkUnstructuredGrid *arcs_out = vtkUnstructuredGrid::SafeDownCast(contour_forest->GetOutput(1));
+	vtkImageData *seg_out = vtkImageData::SafeDownCast(contour_forest->GetOutput(2));
+	if (cache && cache->load_tree(tree_type, nodes_out, arcs_out, seg_out)) {
+		contour_forest->InvokeEvent(vtkCommand::EndEvent);
+		return;
+	}
+	contour_forest->Update();
+	if (cache) {
+		cache->store_tree(tree_type, nodes_out, arcs_out, seg_out);
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <vtkSmartPointer.h>
+#include <vtkImageData.h>
+#include <vtkThreshold.h>
+#include <vtkTable.h>
+#include <vtkUnstructuredGrid.h>
+#include <ttkFTMTree.h>
+#include <ttkPersistenceCurve.h>
+#include <ttkPersistenceDiagram.h>
+#include <ttkTopologicalSimplification.h>
+#include "topology_cache.h"
+#include "pipeline_profiler.h"
+
+/* The TTK pipeline computing the topology of a volume: the persistence diagram
+ * and curves, the simplification of the data removing the pairs below a
+ * persistence threshold, and the contour forest of the simplified data. Each
+ * stage is run explicitly so callers can track them, and results are loaded
+ * from/stored in the cache if one is passed. Doesn't need a GL context, and
+ * is shared by the viewer and the batch tool.
+ */
+class TopologyPipeline {
+	vtkImageData *data;
+	vtkSmartPointer<ttkPersistenceDiagram> diagram;
+	vtkSmartPointer<vtkThreshold> critical_pairs, persistent_pairs;
+	vtkSmartPointer<ttkTopologicalSimplification> simplification;
+	vtkSmartPointer<ttkPersistenceCurve> vtkcurve;
+	// The diagram and curves computed by TTK or loaded from the cache
+	vtkSmartPointer<vtkUnstructuredGrid> diagram_output;
+	std::array<vtkSmartPointer<vtkTable>, 4> curve_tables;
+	TopologyCache *cache;
+	PipelineProfiler *profiler;
+	unsigned int debuglevel;
+	int num_threads;
+
+public:
+	/* Setup the pipeline for the volume data, TTK's filters will use num_threads
+	 * threads or all the cores if it's 0. If a profiler is passed it watches each
+	 * filter, including the contour forest made by create_tree
+	 */
+	TopologyPipeline(vtkImageData *data, unsigned int debug = 0, TopologyCache *cache = nullptr,
+			int num_threads = 0, PipelineProfiler *profiler = nullptr);
+	// Compute the persistence diagram, or load it from the cache
+	void compute_diagram();
+	// Compute the persistence curves of each tree type, or load them from the cache
+	void compute_curves();
+	vtkUnstructuredGrid* get_diagram() const;
+	// Get the persistence curve for the tree type, valid after compute_curves
+	vtkTable* get_curve(const ttk::ftm::TreeType &tree_type) const;
+	ttkTopologicalSimplification* get_simplification() const;
+	/* Simplify the data, removing the pairs with persistence outside [lo, hi]. If the tree
+	 * of the type is cached for this threshold the simplification is skipped and its
+	 * observers notified as if it ran, so they pull the tree from the cache
+	 */
+	void simplify(const float lo, const float hi, const ttk::ftm::TreeType &tree_type);
+	/* Create the contour forest filter on the simplified data, which computes the tree
+	 * and segmentation when updated with update_tree
+	 */
+	vtkSmartPointer<ttkFTMTree> create_tree() const;
+};
+
+/* Compute the tree of the type with the contour forest filter, loading its outputs from
+ * the cache if they're there. A cached tree is announced to the filter's observers with
+ * an EndEvent, as if the filter had run. The tree type is the ttk::ftm::TreeType value,
+ * which is also the tree's key in the cache. The cache can be null
+ */
+void update_tree(ttkFTMTree *contour_forest, const int tree_type, TopologyCache *cache);
+
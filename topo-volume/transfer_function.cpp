@@ -20,6 +20,7 @@
 #undef GLM_ENABLE_EXPERIMENTAL
 
 #include "glt/util.h"
+#include "parallel.h"
 #include "volume.h"
 #include "transfer_function.h"
 
@@ -69,7 +70,7 @@ void TransferFunction::Line::remove_point(const float &x){
 	}
 }
 
-TransferFunction::Palette::Palette() : active_line(3) {
+TransferFunction::Palette::Palette() : active_line(3), version(0) {
 	rgba_lines[0].color = 0xff0000ff;
 	rgba_lines[1].color = 0xff00ff00;
 	rgba_lines[2].color = 0xffff0000;
@@ -93,7 +94,8 @@ TransferFunction::Palette::Palette() : active_line(3) {
 }
 
 TransferFunction::TransferFunction() : active_palette(0), fcn_changed(true),
-	active_fcn_changed(true), palette_tex({0, 0}), histogram(nullptr)
+	active_fcn_changed(true), palette_tex({0, 0}), palette_table(PALETTE_SAMPLES), preint_tex(0), preint_layers(0),
+	histogram(nullptr)
 {
 	palettes.push_back(Palette());
 	num_segmentations = 0;
@@ -104,6 +106,7 @@ TransferFunction::TransferFunction() : active_palette(0), fcn_changed(true),
 TransferFunction::~TransferFunction(){
 	if (palette_tex[0]){
 		glDeleteTextures(2, palette_tex.data());
+		glDeleteTextures(1, &preint_tex);
 	}
 }
 void TransferFunction::draw_ui(){
@@ -138,19 +141,25 @@ void TransferFunction::draw_ui(){
 					palettes[j].segments.erase(i);
 				}
 			}
+			if (segment_palettes[i] != static_cast<unsigned int>(active_palette)) {
+				segment_palettes[i] = active_palette;
+				publish_assignment();
+			}
 		}
 	}
 	ImGui::ListBoxFooter();
 
 	ImGui::End();
 }
-void TransferFunction::render(){
-	const int samples = 256;
+bool TransferFunction::render(){
+	const int samples = PALETTE_SAMPLES;
+	bool changed_palettes = false;
 	// Upload to GL if the transfer function has changed
 	if (!palette_tex[0]){
 		glGenTextures(2, palette_tex.data());
+		glGenTextures(1, &preint_tex);
 		// How to pick what texture unit we're on?
-		glActiveTexture(GL_TEXTURE2);
+		glActiveTexture(GL_TEXTURE0 + PALETTE_UNIT);
 		glBindTexture(GL_TEXTURE_1D_ARRAY, palette_tex[0]);
 		glTexStorage2D(GL_TEXTURE_1D_ARRAY, 1, GL_RGBA8, samples, max_palettes);
 		glTexParameteri(GL_TEXTURE_1D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -169,15 +178,47 @@ void TransferFunction::render(){
 	if (fcn_changed){
 		active_fcn_changed = true;
 		fcn_changed = false;
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_1D_ARRAY, palette_tex[0]);
-
-		// Sample and upload each palette
-		std::vector<uint8_t> imgbuf(samples * 4, 0);
+		// Grow the pre-integrated tables to fit the palettes, which means all the palettes must be re-uploaded
+		if (palettes.size() > preint_layers) {
+			preint_layers = std::min(static_cast<size_t>(glt::next_pow2(palettes.size())),
+					static_cast<size_t>(max_palettes));
+			glActiveTexture(GL_TEXTURE0 + PREINTEGRATED_UNIT);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, preint_tex);
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, samples, samples, preint_layers, 0, GL_RGBA,
+					GL_UNSIGNED_BYTE, nullptr);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			uploaded_versions.clear();
+		}
+		std::vector<size_t> changed;
 		for (size_t i = 0; i < palettes.size(); ++i) {
+			if (i >= uploaded_versions.size() || uploaded_versions[i] != palettes[i].version) {
+				changed.push_back(i);
+			}
+		}
+		uploaded_versions.resize(palettes.size());
+
+		// Sample and upload the palettes that changed
+		glActiveTexture(GL_TEXTURE0 + PALETTE_UNIT);
+		glBindTexture(GL_TEXTURE_1D_ARRAY, palette_tex[0]);
+		std::vector<std::vector<uint8_t>> palette_samples(changed.size(), std::vector<uint8_t>(samples * 4, 0));
+		palette_alpha.resize(palettes.size() * samples);
+		palette_table.rgba.resize(palettes.size() * samples * 4);
+		for (size_t c = 0; c < changed.size(); ++c) {
+			const size_t i = changed[c];
+			std::vector<uint8_t> &imgbuf = palette_samples[c];
 			resample_palette(palettes[i], imgbuf);
 			glTexSubImage2D(GL_TEXTURE_1D_ARRAY, 0, 0, i, samples, 1, GL_RGBA, GL_UNSIGNED_BYTE, imgbuf.data());
+			for (size_t j = 0; j < samples; ++j) {
+				palette_alpha[i * samples + j] = imgbuf[j * 4 + 3];
+			}
+			std::copy(imgbuf.begin(), imgbuf.end(), palette_table.rgba.begin() + i * samples * 4);
+			uploaded_versions[i] = palettes[i].version;
 		}
+		update_preintegrated(changed, palette_samples);
+		changed_palettes = !changed.empty();
 	}
 	if (active_fcn_changed){
 		active_fcn_changed = false;
@@ -193,8 +234,11 @@ void TransferFunction::render(){
 	// TODO: Bindless textures?
 	// Instead of this the palette should send its texture name to the volume
 	// so it can take care of finding it properly when the volume is rendered
-	glActiveTexture(GL_TEXTURE2);
+	glActiveTexture(GL_TEXTURE0 + PALETTE_UNIT);
 	glBindTexture(GL_TEXTURE_1D_ARRAY, palette_tex[0]);
+	glActiveTexture(GL_TEXTURE0 + PREINTEGRATED_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, preint_tex);
+	return changed_palettes;
 }
 void TransferFunction::Execute(vtkObject *caller, unsigned long event_id, void *call_data) {
 	ttkFTMTree *cf = dynamic_cast<ttkFTMTree*>(caller);
@@ -205,24 +249,33 @@ void TransferFunction::Execute(vtkObject *caller, unsigned long event_id, void *
 		if (seg_data) {
 			palettes.clear();
 			palettes.push_back(Palette());
+			uploaded_versions.clear();
 			active_palette = 0;
 			num_segmentations = seg_data->GetRange()[1] + 1;
 			// Select all segments for this palette
 			for (size_t i = 0; i < num_segmentations; ++i) {
 				palettes[active_palette].segments.insert(i);
 			}
+			segment_palettes.clear();
+			segment_palettes.resize(num_segmentations, 0);
 			fcn_changed = true;
+			publish_assignment();
 		}
 	}
 }
-std::vector<unsigned int> TransferFunction::get_segmentation_palettes() const {
-	std::vector<unsigned int> seg_pal(num_segmentations, 0);
-	for (size_t i = 0; i < palettes.size(); ++i) {
-		for (const auto &s : palettes[i].segments) {
-			seg_pal[s] = i;
-		}
+const std::vector<uint8_t>& TransferFunction::get_palette_alpha() const {
+	return palette_alpha;
+}
+const PaletteTable& TransferFunction::get_palette_table() const {
+	return palette_table;
+}
+const std::vector<unsigned int>& TransferFunction::get_segmentation_palettes() const {
+	return segment_palettes;
+}
+void TransferFunction::publish_assignment() {
+	if (assignment_changed) {
+		assignment_changed(segment_palettes);
 	}
-	return seg_pal;
 }
 void TransferFunction::render_palette_ui(Palette &p) {
 	ImGui::RadioButton("Red", &p.active_line, 0); ImGui::SameLine();
@@ -253,9 +306,11 @@ void TransferFunction::render_palette_ui(Palette &p) {
 		// Need to somehow find which line of RGBA the mouse is closest too
 		if (ImGui::GetIO().MouseDown[0]){
 			p.rgba_lines[p.active_line].move_point(mouse_pos.x, mouse_pos);
+			++p.version;
 			fcn_changed = true;
 		} else if (ImGui::IsMouseClicked(1)){
 			p.rgba_lines[p.active_line].remove_point(mouse_pos.x);
+			++p.version;
 			fcn_changed = true;
 		}
 	}
@@ -310,7 +365,7 @@ void TransferFunction::resample_palette(const Palette &p, std::vector<uint8_t> &
 		p.rgba_lines[0].line.begin(), p.rgba_lines[1].line.begin(),
 		p.rgba_lines[2].line.begin(), p.rgba_lines[3].line.begin()
 	};
-	const int samples = 256;
+	const int samples = PALETTE_SAMPLES;
 	const float step = 1.0 / samples;
 	for (size_t i = 0; i < samples; ++i){
 		const float x = step * i;
@@ -325,4 +380,60 @@ void TransferFunction::resample_palette(const Palette &p, std::vector<uint8_t> &
 		}
 	}
 }
+void TransferFunction::update_preintegrated(const std::vector<size_t> &changed,
+		const std::vector<std::vector<uint8_t>> &samples)
+{
+	const size_t n = PALETTE_SAMPLES;
+	if (changed.empty()) {
+		return;
+	}
+
+	// Prefix sums of the alpha and alpha weighted color of each changed palette, so the
+	// average over any range of samples can be found in constant time
+	std::vector<uint32_t> prefix(changed.size() * (n + 1) * 4, 0);
+	for (size_t c = 0; c < changed.size(); ++c) {
+		const uint8_t *rgba = samples[c].data();
+		uint32_t *sums = prefix.data() + c * (n + 1) * 4;
+		for (size_t i = 0; i < n; ++i) {
+			const uint32_t a = rgba[i * 4 + 3];
+			for (size_t j = 0; j < 3; ++j) {
+				sums[(i + 1) * 4 + j] = sums[i * 4 + j] + rgba[i * 4 + j] * a;
+			}
+			sums[(i + 1) * 4 + 3] = sums[i * 4 + 3] + a;
+		}
+	}
+
+	/* Entry (front, back) of a table approximates the ray segment between samples with those
+	 * values by averaging the palette over the samples in between. The color is weighted by alpha
+	 * and self attenuation within the segment is ignored, so it's used like a single sample
+	 */
+	std::vector<uint8_t> tables(changed.size() * n * n * 4);
+	parallel_for(0, changed.size() * n, 16, [&](const size_t begin, const size_t end, const size_t) {
+		for (size_t r = begin; r < end; ++r) {
+			const size_t c = r / n;
+			const size_t back = r % n;
+			const uint32_t *sums = prefix.data() + c * (n + 1) * 4;
+			const uint8_t *rgba = samples[c].data();
+			uint8_t *row = tables.data() + r * n * 4;
+			for (size_t front = 0; front < n; ++front) {
+				const size_t lo = std::min(front, back);
+				const size_t hi = std::max(front, back) + 1;
+				const uint32_t alpha_sum = sums[hi * 4 + 3] - sums[lo * 4 + 3];
+				for (size_t j = 0; j < 3; ++j) {
+					// Fully transparent ranges take the color of the back sample, it's not visible anyway
+					row[front * 4 + j] = alpha_sum == 0 ? rgba[back * 4 + j]
+						: static_cast<uint8_t>((sums[hi * 4 + j] - sums[lo * 4 + j] + alpha_sum / 2) / alpha_sum);
+				}
+				row[front * 4 + 3] = static_cast<uint8_t>((alpha_sum + (hi - lo) / 2) / (hi - lo));
+			}
+		}
+	});
+	glActiveTexture(GL_TEXTURE0 + PREINTEGRATED_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, preint_tex);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t c = 0; c < changed.size(); ++c) {
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, changed[c], n, n, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+				tables.data() + c * n * n * 4);
+	}
+}
 
@@ -2,12 +2,14 @@
 
 #include <set>
 #include <memory>
+#include <functional>
 #include <vector>
 #include <array>
 #include <glm/glm.hpp>
 #include <vtkCommand.h>
 #include "glt/gl_core_4_5.h"
 #include "glt/buffer_allocator.h"
+#include "palette_table.h"
 
 class TransferFunction : public vtkCommand {
 	// A line is made up of points sorted by x, its coordinates are
@@ -37,6 +39,8 @@ class TransferFunction : public vtkCommand {
 		std::array<Line, 4> rgba_lines;
 		// The segments that this palette is applied to
 		std::set<unsigned int> segments;
+		// Incremented when the palette's lines change so we only re-upload changed palettes
+		uint64_t version;
 
 		Palette();
 	};
@@ -48,16 +52,37 @@ class TransferFunction : public vtkCommand {
 	// Track if the function changed and must be re-uploaded.
 	// We start by marking it changed to upload the initial palette
 	bool fcn_changed, active_fcn_changed;
+	// The version of each palette in the palette texture, palettes past the end haven't been uploaded
+	std::vector<uint64_t> uploaded_versions;
+	// The palette each segment uses, updated as segments are assigned to palettes
+	std::vector<unsigned int> segment_palettes;
 	GLint max_palettes;
 
 	/* The 1d palette texture on the GPU (0) for coloring
 	 * the volume and the 2d one (1) for displaying the color map
 	 */
 	std::array<GLuint, 2> palette_tex;
+	// The alpha of each palette's samples, kept on the CPU for empty space skipping
+	std::vector<uint8_t> palette_alpha;
+	// The samples of each palette as uploaded to the palette texture
+	PaletteTable palette_table;
+	/* The pre-integrated tables for each palette, a 2D array texture with a layer per
+	 * palette, allocated with room for preint_layers palettes
+	 */
+	GLuint preint_tex;
+	size_t preint_layers;
 
 public:
+	// The number of samples each palette is resampled to
+	static const int PALETTE_SAMPLES = 256;
+	// The texture units the palettes and pre-integrated tables are bound to
+	static const int PALETTE_UNIT = 2;
+	static const int PREINTEGRATED_UNIT = 8;
+
 	// The histogram for the volume data
 	std::vector<size_t> *histogram;
+	// Called with the palette of each segment when segments are assigned to different palettes
+	std::function<void(const std::vector<unsigned int>&)> assignment_changed;
 
 	TransferFunction();
 	~TransferFunction();
@@ -67,15 +92,29 @@ public:
 	 */
 	void draw_ui();
 	/* Render the transfer function to a 1D texture that can
-	 * be applied to volume data
+	 * be applied to volume data, along with the pre-integrated tables
+	 * for each palette. Only the palettes that changed are re-uploaded.
+	 * Returns true if any palettes changed
 	 */
-	void render();
+	bool render();
 	void Execute(vtkObject *caller, unsigned long event_id, void *call_data) override;
-	// Build the list of which palette each segmentation should use
-	std::vector<unsigned int> get_segmentation_palettes() const;
+	// Get which palette each segment should use
+	const std::vector<unsigned int>& get_segmentation_palettes() const;
+	/* Get the alpha of each palette, with PALETTE_SAMPLES values per palette.
+	 * Updated when the palettes are uploaded in render
+	 */
+	const std::vector<uint8_t>& get_palette_alpha() const;
+	// Get the RGBA samples of each palette, updated when the palettes are uploaded in render
+	const PaletteTable& get_palette_table() const;
 
 private:
 	void render_palette_ui(Palette &p); 
 	void resample_palette(const Palette &p, std::vector<uint8_t> &out);
+	/* Rebuild and upload the pre-integrated tables of the changed palettes from
+	 * their RGBA samples, in parallel over the tables' rows
+	 */
+	void update_preintegrated(const std::vector<size_t> &changed, const std::vector<std::vector<uint8_t>> &samples);
+	// Call the assignment_changed callback with the new segment palettes
+	void publish_assignment();
 };
 
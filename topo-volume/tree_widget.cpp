@@ -20,6 +20,7 @@
 #include <vtkNew.h>
 #include <vtkDataArray.h>
 #include "imgui-1.49/imgui.h"
+#include "topology_pipeline.h"
 #include "tree_widget.h"
 
 std::ostream& operator<<(std::ostream &os, const Branch &b) {
@@ -63,19 +64,23 @@ std::ostream& operator<<(std::ostream &os, const TreeNode &n) {
 	return os;
 }
 
-TreeWidget::TreeWidget(vtkSmartPointer<ttkFTMTree> cf, ttkTopologicalSimplification *simplification)
+TreeWidget::TreeWidget(vtkSmartPointer<ttkFTMTree> cf, ttkTopologicalSimplification *simplification,
+		TopologyCache *cache)
 :
-contour_forest(cf), tree_type(ttk::ftm::TreeType::Contour),
-tree_arcs(nullptr), tree_nodes(nullptr),
-zoom_amount(1.f), scrolling(0.f)
+contour_forest(cf), simplification(simplification), cache(cache), tree_type(ttk::ftm::TreeType::Contour),
+tree_arcs(nullptr), tree_nodes(nullptr), selection_version(0),
+zoom_amount(1.f), scrolling(0.f), segment_stats(nullptr)
 {
 	// Watch for updates to the contour forest
-	cf->SetTreeType(tree_type);
-	cf->Update();
+	update_contour_forest();
 	build_tree();
 	cf->AddObserver(vtkCommand::EndEvent, this);
 	simplification->AddObserver(vtkCommand::EndEvent, this);
 }
+TreeWidget::~TreeWidget() {
+	contour_forest->RemoveObserver(this);
+	simplification->RemoveObserver(this);
+}
 bool point_on_line(const glm::vec2 &start, const glm::vec2 &end, const glm::vec2 &point) {
 	const float click_dist = 4;
 	if (point.x < std::min(start.x, end.x) - click_dist || point.x > std::max(start.x, end.x) + click_dist
@@ -114,6 +119,7 @@ void TreeWidget::draw_ui() {
 
 	if (ImGui::Button("Clear Selection")) {
 		selected_segmentations.clear();
+		++selection_version;
 	}
 
 	ImGui::Text("Click to select branches, Ctrl-click to select multiple");
@@ -196,7 +202,18 @@ void TreeWidget::draw_ui() {
 
 		if (ImGui::IsWindowHovered() && point_on_line(p1, p2, mouse_pos)) {
 			if (!node_hovered) {
-				ImGui::SetTooltip("Segment %lu", b.segmentation_id);
+				const size_t s = b.segmentation_id;
+				if (segment_stats && !segment_stats->empty(s)) {
+					const SegmentStats &st = *segment_stats;
+					ImGui::SetTooltip("Segment %lu\nVoxels: %llu\nValues: [%.2f, %.2f], mean %.2f\n"
+							"Bounds: [%d, %d, %d] - [%d, %d, %d]", s,
+							static_cast<unsigned long long>(st.count[s]),
+							st.value_min[s], st.value_max[s], st.mean(s),
+							st.bbox_min[0][s], st.bbox_min[1][s], st.bbox_min[2][s],
+							st.bbox_max[0][s], st.bbox_max[1][s], st.bbox_max[2][s]);
+				} else {
+					ImGui::SetTooltip("Segment %lu", s);
+				}
 			}
 			if (ImGui::IsMouseClicked(0)) {
 				branch_selection = b.segmentation_id;
@@ -222,6 +239,7 @@ void TreeWidget::draw_ui() {
 			} else if (!was_selected) {
 				selected_segmentations.push_back(branch_selection);
 			}
+			++selection_version;
 		}
 	}
 
@@ -243,13 +261,15 @@ void TreeWidget::draw_ui() {
 	}
 	if (new_tree_type != tree_type) {
 		tree_type = new_tree_type;
-		contour_forest->SetTreeType(tree_type);
-		contour_forest->Update();
+		update_contour_forest();
 	}
 }
 const std::vector<uint32_t>& TreeWidget::get_selection() const {
 	return selected_segmentations;
 }
+uint64_t TreeWidget::get_selection_version() const {
+	return selection_version;
+}
 void TreeWidget::Execute(vtkObject *caller, unsigned long event_id, void *call_data) {
 	// If the contour forest filter called us, update the tree. Otherwise the simplification changed
 	// and we should recompute the tree now.
@@ -259,22 +279,21 @@ void TreeWidget::Execute(vtkObject *caller, unsigned long event_id, void *call_d
 		// It seems that updating the contour forest re-updates the simplification (who just called us),
 		// so remove us as an observer before updating CF, then re-add us.
 		caller->RemoveObserver(this);
-		contour_forest->Update();
+		update_contour_forest();
 		caller->AddObserver(event_id, this);
 	}
 }
+void TreeWidget::update_contour_forest() {
+	update_tree(contour_forest.Get(), tree_type, cache);
+}
 ttk::ftm::TreeType TreeWidget::get_tree_type() const {
-	switch (tree_type) {
-		case 0: return ttk::ftm::TreeType::Contour;
-		case 1: return ttk::ftm::TreeType::Split;
-		case 2: return ttk::ftm::TreeType::Join;
-		default: return ttk::ftm::TreeType::Contour;
-	}
+	return static_cast<ttk::ftm::TreeType>(tree_type);
 }
 void TreeWidget::build_tree() {
 	branches.clear();
 	nodes.clear();
 	selected_segmentations.clear();
+	++selection_version;
 	zoom_amount = 1.0;
 	scrolling = glm::vec2(0);
 
@@ -9,6 +9,8 @@
 #include <vtkSmartPointer.h>
 #include <ttkFTMTree.h>
 #include <ttkTopologicalSimplification.h>
+#include "topology_cache.h"
+#include "segment_stats.h"
 
 // A branch in the tree, representing a specific segmentation
 // id of the data
@@ -44,29 +46,48 @@ std::ostream& operator<<(std::ostream &os, const TreeNode &n);
  */
 class TreeWidget : public vtkCommand {
 	vtkSmartPointer<ttkFTMTree> contour_forest;
+	ttkTopologicalSimplification *simplification;
+	TopologyCache *cache;
+	// The ttk::ftm::TreeType being shown, also the tree's key in the cache
 	int tree_type;
 	vtkUnstructuredGrid *tree_nodes;
 	vtkUnstructuredGrid *tree_arcs;
 	std::vector<uint32_t> selected_segmentations;
+	// Incremented each time the selection changes
+	uint64_t selection_version;
 	std::vector<Branch> branches;
 	std::vector<TreeNode> nodes;
 	float zoom_amount;
 	glm::vec2 scrolling;
 
 public:
+	// Statistics of the segments shown in the branch tooltips, can be null
+	const SegmentStats *segment_stats;
+
 	/* Construct the tree widget from the arc and node outputs
 	 * from TTK's FTMTree VTK filter. Will watch the simplification
-	 * for changes and re-update the contour forest accordingly
+	 * for changes and re-update the contour forest accordingly. If a cache
+	 * is passed trees are loaded from it instead of recomputed when possible
 	 */
 	TreeWidget(vtkSmartPointer<ttkFTMTree> contour_forest,
-			ttkTopologicalSimplification *simplification);
+			ttkTopologicalSimplification *simplification, TopologyCache *cache = nullptr);
+	~TreeWidget();
+	TreeWidget(const TreeWidget&) = delete;
+	TreeWidget& operator=(const TreeWidget&) = delete;
 	void draw_ui();
 	const std::vector<uint32_t>& get_selection() const;
+	// Get the version of the selection, which changes whenever the selection does
+	uint64_t get_selection_version() const;
 	// Get the current tree type
         ttk::ftm::TreeType get_tree_type() const; 
 	void Execute(vtkObject *caller, unsigned long event_id, void *call_data) override;
 
 private:
+	/* Update the contour forest for the current tree type, loading its outputs from
+	 * the cache if they're there. A cached tree is announced to the observers with
+	 * an EndEvent, as if the contour forest had run
+	 */
+	void update_contour_forest();
 	// Build the connectivity of the tree from the information TTK gives us
 	void build_tree();
 };
@@ -12,6 +12,8 @@
 #include <vtkDataSetAttributes.h>
 #include <vtkDataSet.h>
 #include "glt/util.h"
+#include "parallel.h"
+#include "transfer_function.h"
 #include "volume.h"
 
 static const std::array<float, 42> CUBE_STRIP = {
@@ -63,11 +65,63 @@ static void vtk_type_to_gl(const int vtk, GLenum &gl_internal, GLenum &gl_type,
 	}
 }
 
-Volume::Volume(vtkImageData *volume, vtkImageData *segmentation)
+// Convert the segment ids to the narrower type Out in parallel, ids are assumed to fit in Out
+template<typename Out, typename In>
+static void narrow_segments(const In *in, const size_t n, Out *out) {
+	parallel_for(0, n, 1 << 20, [&](const size_t begin, const size_t end, const size_t) {
+		for (size_t i = begin; i < end; ++i) {
+			out[i] = static_cast<Out>(std::max(in[i], In(0)));
+		}
+	});
+}
+template<typename Out>
+static void narrow_segments(vtkDataArray *seg, Out *out) {
+	const size_t n = seg->GetNumberOfTuples();
+	void *ptr = seg->GetVoidPointer(0);
+	switch (seg->GetDataType()) {
+		vtkTemplateMacro(narrow_segments(static_cast<const VTK_TT*>(ptr), n, out));
+		default:
+			throw std::runtime_error("Unsupported segmentation data type '"
+					+ std::to_string(seg->GetDataType()) + "'");
+	}
+}
+
+// The texture units the volume's textures are bound to, the palettes and pre-integrated
+// tables are bound by the TransferFunction on its PALETTE_UNIT and PREINTEGRATED_UNIT
+static const int VOLUME_UNIT = 1;
+static const int SEGMENTATION_UNIT = 3;
+static const int OCCUPANCY_UNIT = 4;
+static const int PAGE_TABLE_UNIT = 5;
+static const int SEGMENT_TABLE_UNIT = 7;
+
+// Get the smallest unsigned integer format that fits the segment ids
+static TextureFormat segmentation_format(vtkDataArray *seg) {
+	const size_t num_segments = static_cast<size_t>(std::max(seg->GetRange()[1], 0.0)) + 1;
+	if (num_segments <= 256) {
+		return TextureFormat{GL_R8UI, GL_UNSIGNED_BYTE, GL_RED_INTEGER, 1};
+	} else if (num_segments <= 65536) {
+		return TextureFormat{GL_R16UI, GL_UNSIGNED_SHORT, GL_RED_INTEGER, 2};
+	}
+	return TextureFormat{GL_R32UI, GL_UNSIGNED_INT, GL_RED_INTEGER, 4};
+}
+
+Volume::ShaderVariant::ShaderVariant() : program(0), isovalue(-1), isosurface(-1), step_scale(-1),
+	frame_seed(-1), ray_box_min(-1), ray_box_max(-1), atlas_slots(-1), atlas_dim(-1)
+{}
+Volume::Volume(vtkImageData *volume, vtkImageData *segmentation, unsigned int debuglevel)
 	: vol_data(volume),
 	segmentation(segmentation),
 	uploaded(false),
+	segmentation_uploaded(false),
+	full_upload_pending(false),
+	seg_ids_type(0),
+	shader(0),
+	segment_table_size(0),
 	isovalue(0.f),
+	step_scale(1.f),
+	frame_seed(0),
+	preintegrated(false),
+	image_changed(true),
 	show_isosurface(false),
 	transform_dirty(true),
 	base_matrix(1),
@@ -75,11 +129,21 @@ Volume::Volume(vtkImageData *volume, vtkImageData *segmentation)
 	scaling(1),
 	vol_render_size(0),
 	rotation(1.f, 0.f, 0.f, 0.f),
-	segmentation_selection_changed(false)
+	palette_samples(0),
+	occupancy_changed(false),
+	gpu_memory_budget(size_t(2048) * 1024 * 1024),
+	upload_budget(size_t(64) * 1024 * 1024),
+	ray_box_min(0),
+	ray_box_max(1),
+	segmentation_selection_changed(false),
+	debuglevel(debuglevel)
 {
-	segmentation->AddObserver(vtkCommand::ModifiedEvent, this);
 	vtk_data = vol_data->GetAttributes(vtkDataSet::POINT)->GetArray("ImageFile");
-	seg_data = segmentation->GetAttributes(vtkDataSet::POINT)->GetArray("SegmentationId");
+	seg_data = nullptr;
+	if (segmentation) {
+		segmentation->AddObserver(vtkCommand::ModifiedEvent, this);
+		seg_data = segmentation->GetAttributes(vtkDataSet::POINT)->GetArray("SegmentationId");
+	}
 	if (!vtk_data) {
 		throw std::runtime_error("Nonexistant volume!");
 	}
@@ -95,13 +159,24 @@ Volume::Volume(vtkImageData *volume, vtkImageData *segmentation)
 	build_histogram();
 }
 Volume::~Volume(){
+	if (segmentation) {
+		segmentation->RemoveObserver(this);
+	}
 	if (allocator){
 		allocator->free(cube_buf);
 		allocator->free(vol_props);
 		glDeleteVertexArrays(1, &vao);
 		glDeleteTextures(1, &texture);
 		glDeleteTextures(1, &seg_texture);
-		glDeleteProgram(shader);
+		glDeleteTextures(1, &occupancy_texture);
+		glDeleteTextures(1, &page_table_texture);
+		glDeleteTextures(1, &segment_table_texture);
+		glDeleteBuffers(1, &segment_table_buf);
+		for (auto &s : shaders) {
+			if (s.program != 0) {
+				glDeleteProgram(s.program);
+			}
+		}
 	}
 }
 void Volume::translate(const glm::vec3 &v){
@@ -120,10 +195,19 @@ void Volume::set_base_matrix(const glm::mat4 &m){
 	base_matrix = m;
 	transform_dirty = true;
 }
+void Volume::set_segmentation(vtkImageData *seg) {
+	if (segmentation) {
+		segmentation->RemoveObserver(this);
+	}
+	segmentation = seg;
+	if (segmentation) {
+		segmentation->AddObserver(vtkCommand::ModifiedEvent, this);
+	}
+	segmentation_uploaded = false;
+}
 void Volume::render(std::shared_ptr<glt::BufferAllocator> &buf_allocator) {
 	// We need to apply the inverse volume transform to the eye to get it in the volume's space
-	glm::mat4 vol_transform = glm::translate(translation) * glm::mat4_cast(rotation)
-		* glm::scale(scaling * vol_render_size) * base_matrix;
+	const glm::mat4 vol_transform = get_transform();
 	// Setup shaders, vao and volume texture
 	if (!allocator){
 		glGenVertexArrays(1, &vao);
@@ -165,64 +249,48 @@ void Volume::render(std::shared_ptr<glt::BufferAllocator> &buf_allocator) {
 
 		glGenTextures(1, &texture);
 		glGenTextures(1, &seg_texture);
-
-		// TODO: If drawing multiple volumes they can all share the same program
-		const std::string resource_path = glt::get_resource_path();
-		shader = glt::load_program({std::make_pair(GL_VERTEX_SHADER, resource_path + "vol_vert.glsl"),
-				std::make_pair(GL_FRAGMENT_SHADER, resource_path + "vol_frag.glsl")});
-		glUseProgram(shader);
-
-		glUniform1i(glGetUniformLocation(shader, "volume"), 1);
-		glUniform1i(glGetUniformLocation(shader, "ivolume"), 1);
-		glUniform1i(glGetUniformLocation(shader, "segmentation_volume"), 3);
-		glUniform1i(glGetUniformLocation(shader, "int_texture"), pixel_format == GL_RED_INTEGER ? 1 : 0);
-		glUniform1i(glGetUniformLocation(shader, "palette"), 2);
-		isovalue_unif = glGetUniformLocation(shader, "isovalue");
-		isosurface_unif = glGetUniformLocation(shader, "isosurface");
-	}
-	// Upload the volume data, it's changed
+		glGenTextures(1, &occupancy_texture);
+		glGenTextures(1, &page_table_texture);
+		glGenTextures(1, &segment_table_texture);
+		glGenBuffers(1, &segment_table_buf);
+	}
+	// Upload the volume data or segmentation, whichever has changed
+	if (!uploaded || !segmentation_uploaded){
+		vtk_data = vol_data->GetAttributes(vtkDataSet::POINT)->GetArray("ImageFile");
+		seg_data = segmentation ? segmentation->GetAttributes(vtkDataSet::POINT)->GetArray("SegmentationId")
+			: nullptr;
+		// If the new segmentation changes whether we need bricks or doesn't fit the existing
+		// bricks' layout we have to re-upload everything
+		if (uploaded && (needs_bricking() != static_cast<bool>(bricks)
+					|| (bricks && !bricks->can_replace_segmentation(seg_data,
+							seg_data ? segmentation_format(seg_data) : TextureFormat{}))))
+		{
+			uploaded = false;
+		}
+	}
 	if (!uploaded){
 		uploaded = true;
-		vtk_data = vol_data->GetAttributes(vtkDataSet::POINT)->GetArray("ImageFile");
-		seg_data = segmentation->GetAttributes(vtkDataSet::POINT)->GetArray("SegmentationId");
-
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_3D, texture);
-		upload_volume(vtk_data);
-
-		if (seg_data) {
-			glActiveTexture(GL_TEXTURE3);
-			glBindTexture(GL_TEXTURE_3D, seg_texture);
-			upload_volume(seg_data);
+		segmentation_uploaded = false;
+		// Make sure the segmentation is fully uploaded to the new textures
+		seg_ids.clear();
 
-			glUseProgram(shader);
-			glUniform1i(glGetUniformLocation(shader, "has_segmentation_volume"), 1);
-			const int num_segments = seg_data->GetRange()[1] + 1;
-			// Re-allocing each time we change leaks some, but re-alloc and free seem to screw up
-			// the buffer? Probabaly a todo for me later (will)
-			segmentation_buf = allocator->alloc((2 * num_segments + 1) * sizeof(int),
-					glt::BufAlignment::SHADER_STORAGE_BUFFER);
-			{
-				int *buf = reinterpret_cast<int*>(segmentation_buf.map(GL_SHADER_STORAGE_BUFFER, GL_MAP_WRITE_BIT));
-				buf[0] = num_segments;
-				// The buffer is interleaved [segment, palette, segment, palette, ...]
-				segmentation_palettes.clear();
-				segmentation_palettes.resize(num_segments, 0);
-				segmentation_selections.clear();
-				segmentation_selections.resize(num_segments, 1);
-				int *s = buf + 1;
-				for (const auto &x : segmentation_selections) {
-					*s = x;
-					++s;
-					*s = 0;
-					++s;
-				}
-				segmentation_buf.unmap(GL_SHADER_STORAGE_BUFFER);
-			}
-			segmentation_selection_changed = true;
+		// Drop any uploads still streaming to the old textures
+		streamer.cancel(texture);
+		streamer.cancel(seg_texture);
+		bricks = nullptr;
+		if (needs_bricking()) {
+			GLint max_texture_size = 0;
+			glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_texture_size);
+			const TextureFormat data_format{internal_format, format, pixel_format,
+				static_cast<size_t>(vtk_data->GetDataTypeSize())};
+			bricks = std::make_unique<BrickCache>(vtk_data, seg_data, dims, data_format,
+					seg_data ? segmentation_format(seg_data) : TextureFormat{}, gpu_memory_budget,
+					max_texture_size, debuglevel);
+			bricks->allocate(texture, seg_texture, page_table_texture);
 		} else {
-			glUseProgram(shader);
-			glUniform1i(glGetUniformLocation(shader, "has_segmentation_volume"), 0);
+			glActiveTexture(GL_TEXTURE0 + VOLUME_UNIT);
+			glBindTexture(GL_TEXTURE_3D, texture);
+			upload_volume(vtk_data);
 		}
 
 		// We're changing the volume so also update the volume properties buffer
@@ -241,6 +309,57 @@ void Volume::render(std::shared_ptr<glt::BufferAllocator> &buf_allocator) {
 			vol_props.unmap(GL_UNIFORM_BUFFER);
 			transform_dirty = false;
 		}
+	} else if (!segmentation_uploaded && bricks) {
+		// Only the segmentation changed, re-upload it for the resident bricks
+		bricks->replace_segmentation(seg_data);
+	}
+	// Upload the new segmentation, which leaves the scalar volume as is
+	if (!segmentation_uploaded) {
+		segmentation_uploaded = true;
+		if (seg_data) {
+			if (!bricks) {
+				glActiveTexture(GL_TEXTURE0 + SEGMENTATION_UNIT);
+				glBindTexture(GL_TEXTURE_3D, seg_texture);
+				upload_segmentation(seg_data);
+			}
+
+			const size_t num_segments = static_cast<size_t>(seg_data->GetRange()[1]) + 1;
+			segmentation_palettes.clear();
+			segmentation_palettes.resize(num_segments, 0);
+			segmentation_selections.clear();
+			segmentation_selections.resize(num_segments, 1);
+			// The table only needs re-allocating if the number of segments changed
+			if (num_segments != segment_table_size) {
+				segment_table_size = num_segments;
+				glBindBuffer(GL_TEXTURE_BUFFER, segment_table_buf);
+				glBufferData(GL_TEXTURE_BUFFER, segment_table_size * sizeof(uint16_t), nullptr, GL_DYNAMIC_DRAW);
+				glBindBuffer(GL_TEXTURE_BUFFER, 0);
+				glActiveTexture(GL_TEXTURE0 + SEGMENT_TABLE_UNIT);
+				glBindTexture(GL_TEXTURE_BUFFER, segment_table_texture);
+				glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, segment_table_buf);
+			}
+			segmentation_selection_changed = true;
+			// The segmentation changed so the per segment histograms and stats must be rebuilt
+			build_histogram();
+			build_segment_stats(vtk_data, seg_data, dims, segment_stats);
+		} else {
+			segment_stats.clear();
+		}
+
+		// Build the macrocell grid for the new segmentation, all cells start out occupied
+		build_occupancy_grid(vtk_data, seg_data, dims, occupancy_grid);
+		glActiveTexture(GL_TEXTURE0 + OCCUPANCY_UNIT);
+		glBindTexture(GL_TEXTURE_3D, occupancy_texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, occupancy_grid.grid_dims[0], occupancy_grid.grid_dims[1],
+				occupancy_grid.grid_dims[2], 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, occupancy_grid.occupied.data());
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		occupancy_changed = true;
+		update_ray_bounds();
 	}
 	if (transform_dirty){
 		char *buf = reinterpret_cast<char*>(vol_props.map(GL_UNIFORM_BUFFER, GL_MAP_WRITE_BIT));
@@ -256,44 +375,135 @@ void Volume::render(std::shared_ptr<glt::BufferAllocator> &buf_allocator) {
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
 	glBindBufferRange(GL_UNIFORM_BUFFER, 1, vol_props.buffer, vol_props.offset, vol_props.size);
-	if (segmentation_buf.size != 0 && segmentation_selection_changed) {
-		segmentation_selection_changed = false;
-
-		build_histogram();
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, segmentation_buf.buffer);
-		int *s = reinterpret_cast<int*>(segmentation_buf.map(GL_SHADER_STORAGE_BUFFER, GL_MAP_WRITE_BIT)) + 1;
-		for (size_t i = 0; i < segmentation_selections.size(); ++i, s += 2) {
-			s[0] = segmentation_selections[i];
-			s[1] = segmentation_palettes[i];
+	streamer.process(upload_budget);
+	bool visibility_changed = false;
+	if (segmentation_selection_changed || occupancy_changed) {
+		visibility_changed = update_occupancy();
+	}
+	if (segment_table_size != 0 && (segmentation_selection_changed || visibility_changed)) {
+		if (segmentation_selection_changed) {
+			segmentation_selection_changed = false;
+			update_selection_histogram();
 		}
-		segmentation_buf.unmap(GL_SHADER_STORAGE_BUFFER);
-		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, segmentation_buf.buffer,
-				segmentation_buf.offset, segmentation_buf.size);
+		update_ray_bounds();
+		update_segment_table();
 	}
-	glActiveTexture(GL_TEXTURE1);
+	glActiveTexture(GL_TEXTURE0 + VOLUME_UNIT);
 	glBindTexture(GL_TEXTURE_3D, texture);
-	glActiveTexture(GL_TEXTURE3);
+	glActiveTexture(GL_TEXTURE0 + SEGMENTATION_UNIT);
 	glBindTexture(GL_TEXTURE_3D, seg_texture);
+	glActiveTexture(GL_TEXTURE0 + OCCUPANCY_UNIT);
+	glBindTexture(GL_TEXTURE_3D, occupancy_texture);
+	glActiveTexture(GL_TEXTURE0 + PAGE_TABLE_UNIT);
+	glBindTexture(GL_TEXTURE_3D, page_table_texture);
+	glActiveTexture(GL_TEXTURE0 + SEGMENT_TABLE_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, segment_table_texture);
 
+	const ShaderVariant &variant = shader_variant();
+	shader = variant.program;
 	glUseProgram(shader);
 
-	glUniform1f(isovalue_unif, isovalue);
-	glUniform1i(isosurface_unif, show_isosurface ? 1 : 0);
+	const glm::vec2 scale_bias = value_scale_bias();
+	glUniform1f(variant.isovalue, isovalue * scale_bias.x + scale_bias.y);
+	glUniform1i(variant.isosurface, show_isosurface ? 1 : 0);
+	glUniform1f(variant.step_scale, step_scale);
+	glUniform1i(variant.frame_seed, frame_seed);
+	glUniform3fv(variant.ray_box_min, 1, glm::value_ptr(ray_box_min));
+	glUniform3fv(variant.ray_box_max, 1, glm::value_ptr(ray_box_max));
+	if (bricks) {
+		const std::array<int, 3> &slots = bricks->get_atlas_slots();
+		const std::array<int, 3> atlas_dims = bricks->get_atlas_dims();
+		glUniform3i(variant.atlas_slots, slots[0], slots[1], slots[2]);
+		glUniform3f(variant.atlas_dim, atlas_dims[0], atlas_dims[1], atlas_dims[2]);
+	}
+	image_changed = false;
 
-	glBindVertexArray(vao);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, CUBE_STRIP.size() / 3);
+	// Nothing to draw if none of the selected segments have any voxels, or if a texture
+	// is still being uploaded in full
+	full_upload_pending = full_upload_pending && streamer.busy();
+	if (!full_upload_pending && glm::all(glm::lessThan(ray_box_min, ray_box_max))) {
+		glBindVertexArray(vao);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, CUBE_STRIP.size() / 3);
+	}
 
 	glCullFace(GL_BACK);
 	glDisable(GL_CULL_FACE);
 }
+void Volume::set_palette_alpha(const std::vector<uint8_t> &alpha, const size_t samples) {
+	palette_alpha = alpha;
+	palette_samples = samples;
+	occupancy_changed = true;
+}
+void Volume::set_gpu_memory_budget(const size_t bytes) {
+	gpu_memory_budget = bytes;
+	uploaded = false;
+}
+void Volume::set_upload_budget(const size_t bytes) {
+	upload_budget = bytes;
+}
+bool Volume::uploading() const {
+	return streamer.busy();
+}
+float Volume::upload_progress() const {
+	return streamer.progress();
+}
+void Volume::set_step_scale(const float scale) {
+	if (scale != step_scale) {
+		step_scale = scale;
+		image_changed = true;
+	}
+}
+void Volume::set_frame_seed(const int seed) {
+	frame_seed = seed;
+}
+void Volume::set_preintegrated(const bool on) {
+	if (on != preintegrated) {
+		preintegrated = on;
+		image_changed = true;
+	}
+}
+glm::mat4 Volume::get_transform() const {
+	return glm::translate(translation) * glm::mat4_cast(rotation)
+		* glm::scale(scaling * vol_render_size) * base_matrix;
+}
+vtkDataArray* Volume::get_data_array() const {
+	return vtk_data;
+}
+vtkDataArray* Volume::get_segmentation_array() const {
+	return seg_data;
+}
+const std::array<int, 3>& Volume::get_dims() const {
+	return dims;
+}
+bool Volume::needs_redraw() const {
+	return image_changed || !uploaded || !segmentation_uploaded || segmentation_selection_changed
+		|| occupancy_changed || transform_dirty || streamer.busy();
+}
 void Volume::set_isovalue(float i) {
 	isovalue = i;
+	image_changed = true;
+	// The empty space depends on the isovalue when rendering the isosurface
+	occupancy_changed = occupancy_changed || show_isosurface;
 }
 void Volume::toggle_isosurface(bool on) {
-	show_isosurface = on;
+	if (on != show_isosurface) {
+		show_isosurface = on;
+		image_changed = true;
+		occupancy_changed = true;
+	}
+}
+float Volume::get_isovalue() const {
+	return isovalue;
+}
+glm::vec2 Volume::get_value_range() const {
+	return glm::vec2(vtk_data->GetRange()[0], vtk_data->GetRange()[1]);
+}
+bool Volume::isosurface_enabled() const {
+	return show_isosurface;
 }
 void Volume::Execute(vtkObject *caller, unsigned long event_id, void *call_data) {
-	uploaded = false;
+	// The segmentation was modified, re-upload it and rebuild the segment histograms and stats
+	segmentation_uploaded = false;
 }
 void Volume::build_histogram(){
 	// Find scale & bias for the volume data
@@ -308,39 +518,248 @@ void Volume::build_histogram(){
 		vol_max = vtk_data->GetRange()[1];
 	}
 
-	// Build the histogram for the data
-	histogram.clear();
-	histogram.resize(128, 0);
-	const size_t num_voxels = dims[0] * dims[1] * dims[2];
-	if (format == GL_FLOAT){
-		float *data_ptr = reinterpret_cast<float*>(vtk_data->GetVoidPointer(0));
-		for (size_t i = 0; i < num_voxels; ++i){
-			if (voxel_selected(i)) {
-				size_t bin = static_cast<size_t>((data_ptr[i] - vol_min) / (vol_max - vol_min) * histogram.size());
-				bin = glm::clamp(bin, size_t{0}, histogram.size() - 1);
-				++histogram[bin];
+	// Build the histograms over the data's range for each segment, or the whole volume
+	// if we don't have a segmentation yet
+	build_segment_histograms(vtk_data, seg_data, vtk_data->GetRange()[0], vtk_data->GetRange()[1],
+			128, segment_histograms);
+	update_selection_histogram();
+}
+void Volume::update_selection_histogram() {
+	segment_histograms.sum_selected(segmentation_selections, histogram);
+}
+bool Volume::update_occupancy() {
+	occupancy_changed = false;
+	const glm::vec2 scale_bias = value_scale_bias();
+	PaletteCoverage coverage(palette_alpha, palette_samples, scale_bias.x, scale_bias.y);
+	if (show_isosurface) {
+		coverage.set_isosurface(isovalue);
+	}
+
+	// A segment whose whole value range is transparent in its palette contributes nothing,
+	// so it's skipped like an unselected one. Empty segments are never sampled
+	std::vector<uint8_t> new_visible(segment_stats.size(), 1);
+	for (size_t s = 0; s < segment_stats.size(); ++s) {
+		const size_t p = s < segmentation_palettes.size() ? segmentation_palettes[s] : 0;
+		new_visible[s] = !segment_stats.empty(s)
+			&& coverage.visible(p, segment_stats.value_min[s], segment_stats.value_max[s]);
+	}
+	const bool visibility_changed = new_visible != segment_visible;
+	segment_visible = std::move(new_visible);
+
+	if (occupancy_grid.update_occupied(segmentation_selections, segmentation_palettes, coverage)) {
+		glActiveTexture(GL_TEXTURE0 + OCCUPANCY_UNIT);
+		glBindTexture(GL_TEXTURE_3D, occupancy_texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, occupancy_grid.grid_dims[0], occupancy_grid.grid_dims[1],
+				occupancy_grid.grid_dims[2], GL_RED_INTEGER, GL_UNSIGNED_BYTE, occupancy_grid.occupied.data());
+	}
+	// Page in the bricks that became visible
+	if (bricks) {
+		bricks->update(occupancy_grid);
+	}
+	return visibility_changed;
+}
+glm::vec2 Volume::value_scale_bias() const {
+	// GL normalizes R8 textures to [0, 1] before the shader's scale and bias are applied
+	const float tex_scale = internal_format == GL_R8 ? 1.f / 255.f : 1.f;
+	return glm::vec2(tex_scale / (vol_max - vol_min), -vol_min);
+}
+bool Volume::needs_bricking() const {
+	GLint max_texture_size = 0;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_texture_size);
+	if (dims[0] > max_texture_size || dims[1] > max_texture_size || dims[2] > max_texture_size) {
+		return true;
+	}
+	const size_t num_voxels = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+	size_t bytes = num_voxels * vtk_data->GetDataTypeSize();
+	if (seg_data) {
+		bytes += num_voxels * segmentation_format(seg_data).bytes_per_voxel;
+	}
+	return bytes > gpu_memory_budget;
+}
+void Volume::update_ray_bounds() {
+	if (segment_stats.size() == 0) {
+		ray_box_min = glm::vec3(0);
+		ray_box_max = glm::vec3(1);
+	} else {
+		glm::ivec3 box_min(std::numeric_limits<int>::max());
+		glm::ivec3 box_max(std::numeric_limits<int>::lowest());
+		for (size_t s = 0; s < segment_stats.size(); ++s) {
+			const bool selected = s >= segmentation_selections.size() || segmentation_selections[s] != 0;
+			const bool visible = s >= segment_visible.size() || segment_visible[s] != 0;
+			if (!selected || !visible || segment_stats.empty(s)) {
+				continue;
 			}
-		}
-	} else if (format == GL_INT){
-		int32_t *data_ptr = reinterpret_cast<int32_t*>(vtk_data->GetVoidPointer(0));
-		for (size_t i = 0; i < num_voxels; ++i){
-			if (voxel_selected(i)) {
-				size_t bin = static_cast<size_t>(static_cast<float>(data_ptr[i] - vol_min)
-						/ (vol_max - vol_min) * histogram.size());
-				bin = glm::clamp(bin, size_t{0}, histogram.size() - 1);
-				++histogram[bin];
+			for (size_t i = 0; i < 3; ++i) {
+				box_min[i] = std::min(box_min[i], segment_stats.bbox_min[i][s]);
+				box_max[i] = std::max(box_max[i], segment_stats.bbox_max[i][s]);
 			}
 		}
-	} else if (format == GL_UNSIGNED_BYTE){
-		uint8_t *data_ptr = reinterpret_cast<uint8_t*>(vtk_data->GetVoidPointer(0));
-		const float data_min = vtk_data->GetRange()[0];
-		const float data_max = vtk_data->GetRange()[1];
-		for (size_t i = 0; i < num_voxels; ++i){
-			if (voxel_selected(i)) {
-				size_t bin = static_cast<size_t>((data_ptr[i] - data_min) / (data_max - data_min) * histogram.size());
-				bin = glm::clamp(bin, size_t{0}, histogram.size() - 1);
-				++histogram[bin];
+		if (glm::any(glm::greaterThan(box_min, box_max))) {
+			// Nothing selected, leave the box empty so we skip drawing
+			ray_box_min = glm::vec3(1);
+			ray_box_max = glm::vec3(0);
+		} else {
+			// Pad by a voxel for the interpolation done by samples along the box's faces
+			const glm::vec3 vol_dims(dims[0], dims[1], dims[2]);
+			ray_box_min = glm::clamp(glm::vec3(box_min - 1) / vol_dims, glm::vec3(0), glm::vec3(1));
+			ray_box_max = glm::clamp(glm::vec3(box_max + 2) / vol_dims, glm::vec3(0), glm::vec3(1));
+		}
+	}
+}
+const Volume::ShaderVariant& Volume::shader_variant() {
+	const bool int_texture = pixel_format == GL_RED_INTEGER;
+	const size_t variant = (int_texture ? 1 : 0) | (seg_data ? 2 : 0) | (bricks ? 4 : 0)
+		| (preintegrated ? 8 : 0);
+	if (shaders[variant].program != 0) {
+		return shaders[variant];
+	}
+	std::vector<std::string> defines;
+	if (int_texture) {
+		defines.push_back("INT_TEXTURE");
+	}
+	if (seg_data) {
+		defines.push_back("HAS_SEGMENTATION");
+	}
+	if (bricks) {
+		defines.push_back("BRICKED");
+	}
+	if (preintegrated) {
+		defines.push_back("PREINTEGRATED");
+	}
+	// TODO: If drawing multiple volumes they can all share the same programs
+	const std::string resource_path = glt::get_resource_path();
+	const GLint program = glt::load_program({std::make_pair(GL_VERTEX_SHADER, resource_path + "vol_vert.glsl"),
+			std::make_pair(GL_FRAGMENT_SHADER, resource_path + "vol_frag.glsl")}, defines);
+	if (program == -1) {
+		throw std::runtime_error("Failed to load volume shader variant " + std::to_string(variant));
+	}
+	ShaderVariant &s = shaders[variant];
+	s.program = program;
+	s.isovalue = glGetUniformLocation(program, "isovalue");
+	s.isosurface = glGetUniformLocation(program, "isosurface");
+	s.step_scale = glGetUniformLocation(program, "step_scale");
+	s.frame_seed = glGetUniformLocation(program, "frame_seed");
+	s.ray_box_min = glGetUniformLocation(program, "ray_box_min");
+	s.ray_box_max = glGetUniformLocation(program, "ray_box_max");
+	s.atlas_slots = glGetUniformLocation(program, "atlas_slots");
+	s.atlas_dim = glGetUniformLocation(program, "atlas_dim");
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "volume"), VOLUME_UNIT);
+	glUniform1i(glGetUniformLocation(program, "palette"), TransferFunction::PALETTE_UNIT);
+	glUniform1i(glGetUniformLocation(program, "preint_palette"), TransferFunction::PREINTEGRATED_UNIT);
+	glUniform1i(glGetUniformLocation(program, "segmentation_volume"), SEGMENTATION_UNIT);
+	glUniform1i(glGetUniformLocation(program, "occupancy"), OCCUPANCY_UNIT);
+	glUniform1i(glGetUniformLocation(program, "page_table"), PAGE_TABLE_UNIT);
+	glUniform1i(glGetUniformLocation(program, "segment_table"), SEGMENT_TABLE_UNIT);
+	glUniform1i(glGetUniformLocation(program, "brick_size"), BrickCache::BRICK_SIZE);
+	glUniform1i(glGetUniformLocation(program, "macrocell_size"), OccupancyGrid::CELL_SIZE);
+	return s;
+}
+void Volume::update_segment_table() {
+	std::vector<uint16_t> table(segment_table_size, 0);
+	for (size_t i = 0; i < table.size() && i < segmentation_selections.size(); ++i) {
+		const bool visible = i >= segment_visible.size() || segment_visible[i] != 0;
+		if (segmentation_selections[i] != 0 && visible) {
+			const unsigned int palette = i < segmentation_palettes.size() ? segmentation_palettes[i] : 0;
+			table[i] = static_cast<uint16_t>(std::min(palette + 1, 65535u));
+		}
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, segment_table_buf);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, table.size() * sizeof(uint16_t), table.data());
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+void Volume::upload_segmentation(vtkDataArray *data) {
+	// If the previous segmentation is still streaming the texture doesn't match seg_ids,
+	// so we can't diff against it and have to upload the new one in full
+	if (streamer.pending(seg_texture)) {
+		streamer.cancel(seg_texture);
+		seg_ids.clear();
+	}
+	const TextureFormat fmt = segmentation_format(data);
+	const size_t num_voxels = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+	std::vector<uint8_t> ids(num_voxels * fmt.bytes_per_voxel);
+	switch (fmt.type) {
+		case GL_UNSIGNED_BYTE:
+			narrow_segments(data, ids.data());
+			break;
+		case GL_UNSIGNED_SHORT:
+			narrow_segments(data, reinterpret_cast<uint16_t*>(ids.data()));
+			break;
+		default:
+			narrow_segments(data, reinterpret_cast<uint32_t*>(ids.data()));
+			break;
+	}
+
+	const int brick_size = BrickCache::BRICK_SIZE;
+	const std::array<int, 3> brick_dims = {
+		(dims[0] + brick_size - 1) / brick_size,
+		(dims[1] + brick_size - 1) / brick_size,
+		(dims[2] + brick_size - 1) / brick_size
+	};
+	const size_t num_bricks = static_cast<size_t>(brick_dims[0]) * brick_dims[1] * brick_dims[2];
+	// The offset and size of each brick along each axis
+	auto brick_region = [&](const size_t b, std::array<int, 3> &offset, std::array<int, 3> &size) {
+		offset[0] = (b % brick_dims[0]) * brick_size;
+		offset[1] = ((b / brick_dims[0]) % brick_dims[1]) * brick_size;
+		offset[2] = (b / (brick_dims[0] * brick_dims[1])) * brick_size;
+		for (size_t i = 0; i < 3; ++i) {
+			size[i] = std::min(brick_size, dims[i] - offset[i]);
+		}
+	};
+	const bool full_upload = ids.size() != seg_ids.size() || fmt.type != seg_ids_type;
+	std::vector<uint8_t> changed;
+	if (full_upload) {
+		glTexImage3D(GL_TEXTURE_3D, 0, fmt.internal_format, dims[0], dims[1], dims[2], 0, fmt.pixel_format,
+				fmt.type, nullptr);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	} else {
+		// Diff the new ids against the ones in the texture brick by brick, and only
+		// upload the bricks that changed
+		changed.resize(num_bricks, 0);
+		parallel_for(0, num_bricks, 16, [&](const size_t begin, const size_t end, const size_t) {
+			for (size_t b = begin; b < end; ++b) {
+				std::array<int, 3> offset, size;
+				brick_region(b, offset, size);
+				for (int z = 0; z < size[2] && !changed[b]; ++z) {
+					for (int y = 0; y < size[1]; ++y) {
+						const size_t row = ((static_cast<size_t>(offset[2]) + z) * dims[1] + offset[1] + y)
+							* dims[0] + offset[0];
+						if (std::memcmp(ids.data() + row * fmt.bytes_per_voxel,
+									seg_ids.data() + row * fmt.bytes_per_voxel,
+									size[0] * fmt.bytes_per_voxel) != 0)
+						{
+							changed[b] = 1;
+							break;
+						}
+					}
+				}
 			}
+		});
+	}
+	// The streamer reads from seg_ids, which holds the ids until the next segmentation
+	seg_ids = std::move(ids);
+	seg_ids_type = fmt.type;
+	if (full_upload) {
+		streamer.upload(seg_texture, fmt, {0, 0, 0}, dims, seg_ids.data(), dims);
+		full_upload_pending = true;
+	} else {
+		size_t num_changed = 0;
+		for (size_t b = 0; b < num_bricks; ++b) {
+			if (!changed[b]) {
+				continue;
+			}
+			++num_changed;
+			std::array<int, 3> offset, size;
+			brick_region(b, offset, size);
+			streamer.upload(seg_texture, fmt, offset, size, seg_ids.data(), dims);
+		}
+		if (debuglevel >= 1) {
+			std::cout << "Re-uploading " << num_changed << " of " << num_bricks << " segmentation bricks\n";
 		}
 	}
 }
@@ -348,9 +767,13 @@ void Volume::upload_volume(vtkDataArray *data) {
 	GLenum internal_fmt, data_fmt, px_fmt;
 	vtk_type_to_gl(data->GetDataType(), internal_fmt, data_fmt, px_fmt);
 
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	// Allocate the texture and stream the data into it
 	glTexImage3D(GL_TEXTURE_3D, 0, internal_fmt, dims[0], dims[1], dims[2], 0, px_fmt,
-			data_fmt, (char*)data->GetVoidPointer(0));
+			data_fmt, nullptr);
+	streamer.cancel(texture);
+	streamer.upload(texture, TextureFormat{internal_fmt, data_fmt, px_fmt,
+			static_cast<size_t>(data->GetDataTypeSize())}, {0, 0, 0}, dims, data->GetVoidPointer(0), dims);
+	full_upload_pending = true;
 
 	if (std::strcmp(data->GetName(), "SegmentationId") == 0) {
 		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -363,12 +786,3 @@ void Volume::upload_volume(vtkDataArray *data) {
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 }
-bool Volume::voxel_selected(const size_t i) const {
-	return true;
-	if (seg_data && !segmentation_selections.empty()) {
-		const int seg = *seg_data->GetTuple(i);
-		return segmentation_selections[seg] != 0;
-	}
-	return true;
-}
-
@@ -11,13 +11,27 @@
 #include <vtkCommand.h>
 #include "glt/gl_core_4_5.h"
 #include "glt/buffer_allocator.h"
+#include "histogram.h"
+#include "segment_stats.h"
+#include "occupancy_grid.h"
+#include "brick_cache.h"
+#include "texture_streamer.h"
 
-/* Manages loading and rendering a volume with GPU ray casting
- * Volume can be a raw or idx file
- * TODO: Loading the volume from disk (e.g. changing raw dims or data type
- * or picking a new hz-level or field from IDX) should be asynchronous
+/* Manages rendering a volume with GPU ray casting. The volume is loaded
+ * asynchronously by the AsyncLoader, and the segmentation can be set once
+ * the topology has been computed
  */
 class Volume : public vtkCommand {
+	// A shader variant's program and the locations of the uniforms set each frame,
+	// looked up once when the program is built
+	struct ShaderVariant {
+		GLuint program;
+		GLint isovalue, isosurface, step_scale, frame_seed, ray_box_min, ray_box_max,
+			atlas_slots, atlas_dim;
+
+		ShaderVariant();
+	};
+
 	// If dims are -1 no volume has been loaded, e.g. for raw
 	// the user must input the dimensions and data type into the picker
 	// TODO: Do I need both dims and render_dims? in gpu_dvr we use
@@ -28,20 +42,63 @@ class Volume : public vtkCommand {
 	std::string data_field_name;
 	std::array<int, 3> dims;
 	GLenum internal_format, format, pixel_format;
-	bool uploaded;
+	// Track if the volume and segmentation must be uploaded, the volume is only
+	// re-uploaded if it changes while the segmentation changes when the tree does
+	bool uploaded, segmentation_uploaded;
+	// Set while a texture is streaming in full, when it has no valid data to draw yet.
+	// Partial updates keep drawing with what's already in the textures
+	bool full_upload_pending;
+	// The segment ids in the segmentation texture, used to only re-upload the bricks that changed
+	std::vector<uint8_t> seg_ids;
+	GLenum seg_ids_type;
 
 	// GL stuff
-	GLuint shader, vao, texture, seg_texture;
-	GLuint isovalue_unif, isosurface_unif;
+	GLuint shader, vao, texture, seg_texture, occupancy_texture, page_table_texture;
+	/* The shader is specialized for whether the volume is an integer texture, has a
+	 * segmentation, is bricked and uses the pre-integrated palettes, the variants are
+	 * built as needed. See shader_variant
+	 */
+	std::array<ShaderVariant, 16> shaders;
+	// Table of the palette + 1 of each selected segment, or 0 for unselected segments,
+	// read by the shader through a buffer texture
+	GLuint segment_table_buf, segment_table_texture;
+	size_t segment_table_size;
 	float isovalue;
+	// Multiplier for the sampling step, larger steps trade quality for speed
+	float step_scale;
+	// Seed for the ray start jitter, changed each frame when accumulating frames
+	int frame_seed;
+	// Classify ray segments between samples with the pre-integrated palettes
+	bool preintegrated;
+	// Set when a setter changes the rendered image, cleared when rendered
+	bool image_changed;
 	bool show_isosurface;
 	std::shared_ptr<glt::BufferAllocator> allocator;
-	glt::SubBuffer cube_buf, vol_props, segmentation_buf;
+	glt::SubBuffer cube_buf, vol_props;
 	bool transform_dirty;
 	// Base transformation matrix, e.g. the IDX logical to physical transform
 	glm::mat4 base_matrix;
 	glm::vec3 translation, scaling, vol_render_size;
 	glm::quat rotation;
+	// Macrocell grid used to skip empty space, its occupancy is recomputed when the
+	// selection or palettes change
+	OccupancyGrid occupancy_grid;
+	std::vector<uint8_t> palette_alpha;
+	size_t palette_samples;
+	bool occupancy_changed;
+	/* 1 if the segment's value range maps to some non-zero alpha in its palette. Invisible
+	 * segments are treated as unselected by the shader. Recomputed with the occupancy
+	 */
+	std::vector<uint8_t> segment_visible;
+	// Used instead of uploading the full textures if the volume is too big for the GPU
+	std::unique_ptr<BrickCache> bricks;
+	size_t gpu_memory_budget;
+	// Full volume and segmentation uploads are streamed over several frames, sending at
+	// most upload_budget bytes each frame. The volume isn't drawn until they're done
+	TextureStreamer streamer;
+	size_t upload_budget;
+	// Box around the selected segments in the volume's [0, 1] space that we draw and cast rays in
+	glm::vec3 ray_box_min, ray_box_max;
 
 public:
 	// TODO: make private, public only temporarily Min and max values in the data set
@@ -50,11 +107,18 @@ public:
 	// TODO: Should the volume no longer build a histogram and instead the
 	// user handles it? Maybe the user could pass the value min/max as well?
 	std::vector<size_t> histogram;
+	// The histogram of each segment, the histogram of the selection is the sum of these
+	SegmentHistograms segment_histograms;
+	// Voxel count, value range and bounds of each segment, rebuilt when the segmentation changes
+	SegmentStats segment_stats;
 	std::vector<unsigned int> segmentation_selections;
 	std::vector<unsigned int> segmentation_palettes;
 	bool segmentation_selection_changed;
+	// Upload stats are printed at debug level 1 and above
+	unsigned int debuglevel;
 
-	Volume(vtkImageData *volume, vtkImageData *segmentation);
+	// The segmentation can be null if it's not computed yet, see set_segmentation
+	Volume(vtkImageData *volume, vtkImageData *segmentation, unsigned int debuglevel = 0);
 	~Volume();
 	Volume(const Volume&) = delete;
 	Volume& operator=(const Volume&) = delete;
@@ -69,21 +133,93 @@ public:
 		return shader;
 	}
 	void set_base_matrix(const glm::mat4 &m);
+	// Get the transform from the volume's [0, 1] space to world space
+	glm::mat4 get_transform() const;
+	/* Get the volume's data and segmentation arrays and dimensions, for rendering it
+	 * without the GPU. The segmentation is null if it hasn't been set
+	 */
+	vtkDataArray* get_data_array() const;
+	vtkDataArray* get_segmentation_array() const;
+	const std::array<int, 3>& get_dims() const;
+	// Set the segmentation volume to render the volume with, the volume will watch it for changes
+	void set_segmentation(vtkImageData *segmentation);
 	/* Render the volume data, this will also upload the volume
 	 * if this is the first time the data is being rendered.
 	 */
 	void render(std::shared_ptr<glt::BufferAllocator> &buf_allocator);
+	/* Set the alpha of each palette, with samples values per palette, used to find the
+	 * empty regions of the volume. Marks the occupancy to be recomputed, so this should
+	 * only be called when the palettes change
+	 */
+	void set_palette_alpha(const std::vector<uint8_t> &alpha, const size_t samples);
+	/* Set the GPU memory budget in bytes for the volume and segmentation textures,
+	 * volumes larger than this are bricked and only the visible bricks kept on the GPU
+	 */
+	void set_gpu_memory_budget(const size_t bytes);
+	// Set the number of bytes of the volume or segmentation to upload each frame
+	void set_upload_budget(const size_t bytes);
+	// Check if the volume or segmentation is still being uploaded, in which case it isn't drawn
+	bool uploading() const;
+	// Fraction of the pending volume or segmentation upload that's done
+	float upload_progress() const;
+	// Set the multiplier for the sampling step, 1 samples each voxel along the ray
+	void set_step_scale(const float scale);
+	/* Set the seed for jittering the ray start positions, rendering with different
+	 * seeds and averaging the frames converges to a smoother image
+	 */
+	void set_frame_seed(const int seed);
+	/* Use the transfer function's pre-integrated tables to classify the segments between
+	 * samples instead of the samples themselves, which allows larger steps at similar quality
+	 */
+	void set_preintegrated(const bool on);
+	/* Check if the volume would render differently than it did last frame, e.g. because
+	 * its data, selection, palette alpha or transform changed or it's still uploading
+	 */
+	bool needs_redraw() const;
+	/* Set the isovalue of the isosurface, in the volume's data values. The isosurface
+	 * is rendered instead of the volume when enabled with toggle_isosurface
+	 */
 	void set_isovalue(float isovalue);
 	void toggle_isosurface(bool on);
+	float get_isovalue() const;
+	bool isosurface_enabled() const;
+	/* Get the range of the volume's data values, which the isovalue is in. Unlike
+	 * vol_min/vol_max this isn't the normalized range for 8 bit textures
+	 */
+	glm::vec2 get_value_range() const;
 	void Execute(vtkObject *caller, unsigned long event_id, void *call_data) override;
 
 private:
-	// Find the min/max of the data and build the histogram
+	// Find the min/max of the data and build the histogram of each segment
 	void build_histogram();
+	// Build the histogram of the selected segments by summing their histograms
+	void update_selection_histogram();
+	/* Recompute which macrocells are occupied and upload them if they changed, along with
+	 * the visibility of each segment. Returns true if the visibility of any segment changed
+	 */
+	bool update_occupancy();
+	// Get the shader for the current volume and segmentation, building it if needed
+	const ShaderVariant& shader_variant();
+	// Pack the segment selections, visibility and palettes into the segment table and upload it
+	void update_segment_table();
+	/* Compute the box bounding the selected and visible segments from their stats.
+	 * Without a segmentation this is the full volume
+	 */
+	void update_ray_bounds();
+	/* Get the scale and bias mapping data values to the palette coordinates, matching
+	 * how the shader maps the values it samples from the volume texture
+	 */
+	glm::vec2 value_scale_bias() const;
+	// Check if the volume and segmentation are too big to upload as full textures
+	bool needs_bricking() const;
+	/* Upload the segmentation ids to the bound texture using the smallest of R8UI,
+	 * R16UI or R32UI that fits the number of segments. If the texture already holds
+	 * a segmentation of the same format only the bricks that changed are uploaded.
+	 * The ids are streamed to the texture by the streamer
+	 */
+	void upload_segmentation(vtkDataArray *data);
 	// Upload the vtk data passed, dims are assumed to be the same but the
-	// data type can differ
+	// data type can differ. The data is streamed to the texture by the streamer
 	void upload_volume(vtkDataArray *data);
-	// Check if the voxel is in the selected segments
-	bool voxel_selected(const size_t i) const;
 };
 
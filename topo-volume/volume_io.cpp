@@ -0,0 +1,149 @@
+#include <array>
+#include <iostream>
+#include <regex>
+#include <stdexcept>
+#include <vtkType.h>
+#include <vtkXMLImageDataReader.h>
+#include <vtkXMLImageDataWriter.h>
+#include <vtkXMLUnstructuredGridWriter.h>
+#include <vtkDelimitedTextWriter.h>
+#include <vtkImageReader2.h>
+#include "raw_volume.h"
+#include "volume_io.h"
+
+VolumeLoadOptions::VolumeLoadOptions()
+	: raw_big_endian(false), raw_loader(RawLoader::MMAP), raw_chunk_size(64 * 1024 * 1024), debuglevel(0)
+{}
+bool parse_raw_option(const int argc, const char **argv, int &i, VolumeLoadOptions &options) {
+	const std::string str(argv[i]);
+	if (str == "-raw-big-endian") {
+		options.raw_big_endian = true;
+		return true;
+	}
+	if (str != "-raw-loader" && str != "-raw-chunk-size") {
+		return false;
+	}
+	if (i + 1 >= argc) {
+		throw std::runtime_error("Missing value for option " + str);
+	}
+	const std::string value(argv[++i]);
+	if (str == "-raw-chunk-size") {
+		options.raw_chunk_size = std::stoull(value) * 1024 * 1024;
+	} else if (value == "mmap") {
+		options.raw_loader = RawLoader::MMAP;
+	} else if (value == "parallel") {
+		options.raw_loader = RawLoader::PARALLEL;
+	} else if (value == "vtk") {
+		options.raw_loader = RawLoader::VTK;
+	} else {
+		throw std::runtime_error("Unrecognized raw loader '" + value
+				+ "', expected one of mmap, parallel or vtk");
+	}
+	return true;
+}
+ttk::ftm::TreeType parse_tree_type(const std::string &name) {
+	if (name == "contour") {
+		return ttk::ftm::TreeType::Contour;
+	} else if (name == "split") {
+		return ttk::ftm::TreeType::Split;
+	} else if (name == "join") {
+		return ttk::ftm::TreeType::Join;
+	}
+	throw std::runtime_error("Unrecognized tree type '" + name
+			+ "', expected one of contour, split or join");
+}
+vtkSmartPointer<vtkImageData> load_volume(const std::string &file, const VolumeLoadOptions &options,
+		const std::atomic<bool> *cancel)
+{
+	vtkSmartPointer<vtkImageData> vol = nullptr;
+	const std::string file_ext = file.substr(file.size() - 3);
+	if (file_ext == "vti") {
+		vtkSmartPointer<vtkXMLImageDataReader> reader
+			= vtkSmartPointer<vtkXMLImageDataReader>::New();
+		reader->SetFileName(file.c_str());
+		reader->Update();
+		vol = reader->GetOutput();
+	} else if (file_ext == "raw") {
+		std::cerr << "Note: raw files do not have voxel spacing information, if your "
+			<< "file does not have square voxels it may appear incorrectly scaled\n";
+
+		const std::regex match_filename("(\\w+)_(\\d+)x(\\d+)x(\\d+)_(.+)\\.raw");
+		auto matches = std::sregex_iterator(file.begin(), file.end(), match_filename);
+		if (matches == std::sregex_iterator() || matches->size() != 6) {
+			std::cerr << "Unrecognized raw volume naming scheme, expected a format like: "
+				<< "'<name>_<X>x<Y>x<Z>_<data type>.raw' but '" << file << "' did not match"
+				<< std::endl;
+			throw std::runtime_error("Invalaid raw file naming scheme");
+		}
+
+		std::array<int, 3> dims = {std::stoi((*matches)[2]), std::stoi((*matches)[3]), std::stoi((*matches)[4])};
+		std::string data_type = (*matches)[5];
+		int vtk_data_type = -1;
+		if (data_type == "uint8") {
+			vtk_data_type = VTK_UNSIGNED_CHAR;
+		} else if (data_type == "int8") {
+			vtk_data_type = VTK_CHAR;
+		} else if (data_type == "uint16") {
+			vtk_data_type = VTK_UNSIGNED_SHORT;
+		} else if (data_type == "int16") {
+			vtk_data_type = VTK_SHORT;
+		} else if (data_type == "float32") {
+			vtk_data_type = VTK_FLOAT;
+		} else {
+			throw std::runtime_error("Unsupported or unrecognized data type: " + data_type);
+		}
+
+		// If the data is already in our byte order we can map it directly and skip
+		// copying it through the reader
+		const bool byte_order_matches = options.raw_big_endian != host_is_little_endian()
+			|| vtk_data_type == VTK_UNSIGNED_CHAR || vtk_data_type == VTK_CHAR;
+		if (options.raw_loader == RawLoader::MMAP && byte_order_matches) {
+			vol = map_raw_volume(file, dims, vtk_data_type);
+		} else if (options.raw_loader == RawLoader::PARALLEL) {
+			vol = read_raw_volume_parallel(file, dims, vtk_data_type, !byte_order_matches,
+					options.raw_chunk_size, options.debuglevel, cancel);
+		}
+		if (vol.Get() == nullptr) {
+			vtkSmartPointer<vtkImageReader2> reader = vtkSmartPointer<vtkImageReader2>::New();
+			reader->SetFileName(file.c_str());
+			reader->SetFileDimensionality(3);
+			reader->SetDataExtent(0, dims[0] - 1, 0, dims[1] - 1, 0, dims[2] - 1);
+			reader->SetDataScalarType(vtk_data_type);
+			if (options.raw_big_endian) {
+				reader->SetDataByteOrderToBigEndian();
+			} else {
+				reader->SetDataByteOrderToLittleEndian();
+			}
+			reader->Update();
+			vol = reader->GetOutput();
+		}
+	}
+	if (vol.Get() == nullptr) {
+		throw std::runtime_error("Failed to load volume file " + file);
+	}
+	return vol;
+}
+void write_image_data(const std::string &file, vtkImageData *data) {
+	vtkSmartPointer<vtkXMLImageDataWriter> writer = vtkSmartPointer<vtkXMLImageDataWriter>::New();
+	writer->SetFileName(file.c_str());
+	writer->SetInputData(data);
+	if (!writer->Write()) {
+		throw std::runtime_error("Failed to write image data to " + file);
+	}
+}
+void write_unstructured_grid(const std::string &file, vtkUnstructuredGrid *grid) {
+	vtkSmartPointer<vtkXMLUnstructuredGridWriter> writer = vtkSmartPointer<vtkXMLUnstructuredGridWriter>::New();
+	writer->SetFileName(file.c_str());
+	writer->SetInputData(grid);
+	if (!writer->Write()) {
+		throw std::runtime_error("Failed to write unstructured grid to " + file);
+	}
+}
+void write_table(const std::string &file, vtkTable *table) {
+	vtkSmartPointer<vtkDelimitedTextWriter> writer = vtkSmartPointer<vtkDelimitedTextWriter>::New();
+	writer->SetFileName(file.c_str());
+	writer->SetInputData(table);
+	if (!writer->Write()) {
+		throw std::runtime_error("Failed to write table to " + file);
+	}
+}
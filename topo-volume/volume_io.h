@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vtkSmartPointer.h>
+#include <vtkImageData.h>
+#include <vtkTable.h>
+#include <vtkUnstructuredGrid.h>
+#include <ttkFTMTree.h>
+
+// How to load RAW files: mmap them if possible, read them with the parallel
+// chunked reader or with VTK's reader
+enum class RawLoader { MMAP, PARALLEL, VTK };
+
+struct VolumeLoadOptions {
+	// RAW files in the Open SciVis collection are little endian
+	bool raw_big_endian;
+	RawLoader raw_loader;
+	// Chunk size for the parallel RAW reader in bytes
+	size_t raw_chunk_size;
+	unsigned int debuglevel;
+
+	VolumeLoadOptions();
+};
+
+/* Parse the RAW file option at argv[i] into the options, advancing i past its value:
+ * -raw-big-endian, -raw-loader <mmap|parallel|vtk> or -raw-chunk-size <MB>.
+ * Returns false if argv[i] isn't a RAW option. Throws if its value is missing or invalid
+ */
+bool parse_raw_option(const int argc, const char **argv, int &i, VolumeLoadOptions &options);
+// Parse a tree type name, one of contour, split or join. Throws if it's not one of them
+ttk::ftm::TreeType parse_tree_type(const std::string &name);
+
+/* Load a VTI file or RAW volume. RAW volume files must follow
+ * the naming convention used in the Open SciVis Datasets collection
+ * https://github.com/pavolzetor/open_scivis_datasets where
+ * the file name is <name>_<X>x<Y>x<Z>_<data type>.raw
+ * If the cancel flag is passed the load is stopped when it's set, if the reader supports it
+ */
+vtkSmartPointer<vtkImageData> load_volume(const std::string &file, const VolumeLoadOptions &options,
+		const std::atomic<bool> *cancel = nullptr);
+// Write image data, e.g. a segmentation, as a VTI file. Throws if the file can't be written
+void write_image_data(const std::string &file, vtkImageData *data);
+// Write an unstructured grid, e.g. the tree nodes or arcs, as a VTU file
+void write_unstructured_grid(const std::string &file, vtkUnstructuredGrid *grid);
+// Write a table, e.g. a persistence curve, as a CSV file
+void write_table(const std::string &file, vtkTable *table);
+